@@ -0,0 +1,100 @@
+@echo off
+setlocal
+
+set SRC_DIR=%~dp0..\src
+set BENCH_DIR=%~dp0
+set OUT_DIR=%~dp0..\bin
+if not exist "%OUT_DIR%" mkdir "%OUT_DIR%"
+
+echo Building prefill_bench.exe...
+
+g++ -O2 -o "%OUT_DIR%\prefill_bench.exe" -I "%SRC_DIR%" ^
+    "%BENCH_DIR%prefill_bench.cpp" ^
+    "%SRC_DIR%\json_utils.cpp" ^
+    "%SRC_DIR%\http_client.cpp" ^
+    "%SRC_DIR%\http_client_winhttp.cpp" ^
+    "%SRC_DIR%\http_client_socket.cpp" ^
+    "%SRC_DIR%\tcp_socket.cpp" ^
+    -lwinhttp -lws2_32 -static-libgcc -static-libstdc++
+
+if %ERRORLEVEL% NEQ 0 goto :failed
+
+echo Building request_writer_bench.exe...
+
+g++ -O2 -o "%OUT_DIR%\request_writer_bench.exe" -I "%SRC_DIR%" ^
+    "%BENCH_DIR%request_writer_bench.cpp" ^
+    "%SRC_DIR%\json_utils.cpp" ^
+    -static-libgcc -static-libstdc++
+
+if %ERRORLEVEL% NEQ 0 goto :failed
+
+rem Same benchmark once per HTTP backend
+echo Building http_latency_bench.exe (WinHTTP)...
+
+g++ -O2 -o "%OUT_DIR%\http_latency_bench.exe" -I "%SRC_DIR%" ^
+    "%BENCH_DIR%http_latency_bench.cpp" ^
+    "%SRC_DIR%\http_client.cpp" ^
+    "%SRC_DIR%\http_client_winhttp.cpp" ^
+    "%SRC_DIR%\http_client_socket.cpp" ^
+    "%SRC_DIR%\tcp_socket.cpp" ^
+    -lwinhttp -lws2_32 -static-libgcc -static-libstdc++
+
+if %ERRORLEVEL% NEQ 0 goto :failed
+
+echo Building http_latency_bench_sockets.exe...
+
+g++ -O2 -DAI_SHELL_HTTP_SOCKETS -o "%OUT_DIR%\http_latency_bench_sockets.exe" ^
+    -I "%SRC_DIR%" ^
+    "%BENCH_DIR%http_latency_bench.cpp" ^
+    "%SRC_DIR%\http_client.cpp" ^
+    "%SRC_DIR%\http_client_winhttp.cpp" ^
+    "%SRC_DIR%\http_client_socket.cpp" ^
+    "%SRC_DIR%\tcp_socket.cpp" ^
+    -lwinhttp -lws2_32 -static-libgcc -static-libstdc++
+
+if %ERRORLEVEL% NEQ 0 goto :failed
+
+echo Building mock_ollama.exe...
+
+g++ -O2 -o "%OUT_DIR%\mock_ollama.exe" -I "%SRC_DIR%" ^
+    "%BENCH_DIR%mock_ollama.cpp" ^
+    "%SRC_DIR%\json_utils.cpp" ^
+    "%SRC_DIR%\tcp_socket.cpp" ^
+    -lws2_32 -static-libgcc -static-libstdc++
+
+if %ERRORLEVEL% NEQ 0 goto :failed
+
+echo Building hedge_bench.exe...
+
+g++ -O2 -o "%OUT_DIR%\hedge_bench.exe" -I "%SRC_DIR%" ^
+    "%BENCH_DIR%hedge_bench.cpp" ^
+    "%SRC_DIR%\llm_router.cpp" ^
+    "%SRC_DIR%\context_manager.cpp" ^
+    "%SRC_DIR%\json_utils.cpp" ^
+    "%SRC_DIR%\http_client.cpp" ^
+    "%SRC_DIR%\http_client_winhttp.cpp" ^
+    "%SRC_DIR%\http_client_socket.cpp" ^
+    "%SRC_DIR%\tcp_socket.cpp" ^
+    -lwinhttp -lws2_32 -static-libgcc -static-libstdc++
+
+if %ERRORLEVEL% NEQ 0 goto :failed
+
+echo Building process_bench.exe...
+
+g++ -O2 -o "%OUT_DIR%\process_bench.exe" -I "%SRC_DIR%" ^
+    "%BENCH_DIR%process_bench.cpp" ^
+    "%SRC_DIR%\process_runner.cpp" ^
+    "%SRC_DIR%\process_runner_posix.cpp" ^
+    "%SRC_DIR%\shell_host.cpp" ^
+    "%SRC_DIR%\output_capture.cpp" ^
+    -lpsapi -static-libgcc -static-libstdc++
+
+if %ERRORLEVEL% NEQ 0 goto :failed
+
+echo Build SUCCESS! Output: %OUT_DIR%
+endlocal
+exit /b 0
+
+:failed
+echo Build FAILED!
+exit /b 1
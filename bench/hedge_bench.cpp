@@ -0,0 +1,179 @@
+// Tail latency of llm::Router with and without hedging, against two
+// in-process mock backends on 127.0.0.1 whose time to first token is
+// heavy-tailed: usually fast, sometimes (e.g. a cold KV cache or a busy GPU)
+// an order of magnitude slower.
+//
+// Usage: hedge_bench [requests] [slow-percent] [percentile]
+
+#include "llm_router.h"
+#include "tcp_socket.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+static const int FAST_TTFT_MS = 20;
+static const int SLOW_TTFT_MS = 400;
+static const int WARM_UP_REQUESTS = 10;
+// Router files go next to the binary under this prefix
+static const char *BASE_DIR = "hedge_bench.";
+
+static int g_slow_percent = 10;
+static std::mutex g_rng_mutex;
+static std::mt19937 g_rng(12345);
+
+static int sample_ttft_ms() {
+  std::lock_guard<std::mutex> lock(g_rng_mutex);
+  return (int)(g_rng() % 100) < g_slow_percent ? SLOW_TTFT_MS : FAST_TTFT_MS;
+}
+
+static bool send_str(net::socket_t s, const std::string &data) {
+  return net::send_all(s, data.data(), data.size(), 5000);
+}
+
+static bool send_chunk(net::socket_t s, const std::string &data) {
+  char size[16];
+  std::snprintf(size, sizeof(size), "%zx\r\n", data.size());
+  return send_str(s, size + data + "\r\n");
+}
+
+// Answers every POST with a short streamed chat reply after a sampled delay
+static void serve_connection(net::socket_t s) {
+  std::string buf;
+  char tmp[8192];
+  while (true) {
+    size_t header_end;
+    while ((header_end = buf.find("\r\n\r\n")) == std::string::npos) {
+      long n = net::recv_some(s, tmp, sizeof(tmp), 10000);
+      if (n <= 0) {
+        net::close_socket(s);
+        return;
+      }
+      buf.append(tmp, (size_t)n);
+    }
+    std::string head = buf.substr(0, header_end);
+    size_t body_len = 0;
+    size_t cl = head.find("Content-Length: ");
+    if (cl != std::string::npos)
+      body_len = std::strtoul(head.c_str() + cl + 16, nullptr, 10);
+    while (buf.size() < header_end + 4 + body_len) {
+      long n = net::recv_some(s, tmp, sizeof(tmp), 10000);
+      if (n <= 0) {
+        net::close_socket(s);
+        return;
+      }
+      buf.append(tmp, (size_t)n);
+    }
+    buf.erase(0, header_end + 4 + body_len);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(sample_ttft_ms()));
+    bool ok = send_str(s, "HTTP/1.1 200 OK\r\nContent-Type: "
+                          "application/x-ndjson\r\nTransfer-Encoding: "
+                          "chunked\r\n\r\n");
+    ok = ok && send_chunk(s, "{\"message\":{\"role\":\"assistant\","
+                             "\"content\":\"Get-ChildItem\"},\"done\":false}\n");
+    ok = ok && send_chunk(s, "{\"message\":{\"role\":\"assistant\","
+                             "\"content\":\"\"},\"done\":true}\n");
+    ok = ok && send_str(s, "0\r\n\r\n");
+    if (!ok) {
+      net::close_socket(s);
+      return;
+    }
+  }
+}
+
+static int start_server() {
+  int port = 0;
+  net::socket_t listener = net::listen_tcp("127.0.0.1", 0, &port);
+  if (listener == net::INVALID_SOCKET_VALUE) {
+    std::cerr << "cannot listen\n";
+    std::exit(1);
+  }
+  std::thread([listener] {
+    while (true) {
+      net::socket_t c = net::accept_tcp(listener);
+      if (c == net::INVALID_SOCKET_VALUE)
+        return;
+      std::thread(serve_connection, c).detach();
+    }
+  }).detach();
+  return port;
+}
+
+static double percentile(std::vector<double> v, double p) {
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(v.size() * p / 100))];
+}
+
+static void run(const char *label, double hedge, int requests) {
+  std::remove((std::string(BASE_DIR) + "backend_stats.json").c_str());
+  llm::Router router(BASE_DIR, "bench-model");
+  router.set_hedge_percentile(hedge);
+
+  json::ChatRequestWriter writer;
+  writer.set_stream(true);
+  writer.set_system_prompt("You are a shell.");
+  writer.begin();
+  writer.add_message("user", "list files");
+
+  std::vector<double> ttft_ms;
+  int hedged = 0;
+  for (int i = 0; i < WARM_UP_REQUESTS + requests; ++i) {
+    auto start = bench_clock::now();
+    double first_ms = 0;
+    http::Response r = router.chat(writer, [&](const char *, size_t) {
+      if (first_ms == 0)
+        first_ms = std::chrono::duration<double, std::milli>(
+                       bench_clock::now() - start)
+                       .count();
+      return true;
+    });
+    if (r.status_code != 200 || first_ms == 0) {
+      std::cerr << "request failed\n";
+      std::exit(1);
+    }
+    if (i < WARM_UP_REQUESTS)
+      continue;
+    ttft_ms.push_back(first_ms);
+    hedged += router.last_hedged() ? 1 : 0;
+  }
+  std::cout << label << "\n  first token p50 " << (int)percentile(ttft_ms, 50)
+            << " ms, p95 " << (int)percentile(ttft_ms, 95) << " ms, p99 "
+            << (int)percentile(ttft_ms, 99) << " ms, max "
+            << (int)percentile(ttft_ms, 100) << " ms\n  hedged "
+            << hedged * 100 / requests << "% of requests\n";
+}
+
+int main(int argc, char *argv[]) {
+  int requests = argc > 1 ? std::atoi(argv[1]) : 300;
+  g_slow_percent = argc > 2 ? std::atoi(argv[2]) : 10;
+  double hedge = argc > 3 ? std::atof(argv[3]) : 95;
+
+  int port_a = start_server();
+  int port_b = start_server();
+  {
+    std::ofstream f(std::string(BASE_DIR) + "backends.json");
+    f << "[{\"name\": \"a\", \"host\": \"127.0.0.1\", \"port\": " << port_a
+      << "},\n {\"name\": \"b\", \"host\": \"127.0.0.1\", \"port\": " << port_b
+      << "}]\n";
+  }
+
+  std::cout << requests << " requests, " << g_slow_percent << "% of first "
+            << "tokens take " << SLOW_TTFT_MS << " ms instead of "
+            << FAST_TTFT_MS << " ms\n";
+  run("no hedging", 0, requests);
+  run("hedging", hedge, requests);
+
+  std::remove((std::string(BASE_DIR) + "backends.json").c_str());
+  std::remove((std::string(BASE_DIR) + "backend_stats.json").c_str());
+  return 0;
+}
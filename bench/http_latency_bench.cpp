@@ -0,0 +1,148 @@
+// HTTP client latency benchmark against an in-process mock server on
+// 127.0.0.1: the same requests with connections kept alive versus a new
+// connection per request (server answers "Connection: close").
+//
+// Usage: http_latency_bench [requests]
+
+#include "http_client.h"
+#include "tcp_socket.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+static const char *CHAT_CHUNKS[] = {
+    "{\"message\":{\"role\":\"assistant\",\"content\":\"Get-\"},\"done\":false}\n",
+    "{\"message\":{\"role\":\"assistant\",\"content\":\"ChildItem\"},\"done\":false}\n",
+    "{\"message\":{\"role\":\"assistant\",\"content\":\"\"},\"done\":true}\n"};
+
+static bool send_str(net::socket_t s, const std::string &data) {
+  return net::send_all(s, data.data(), data.size(), 5000);
+}
+
+// Minimal HTTP/1.1 server loop for one connection
+static void serve_connection(net::socket_t s) {
+  std::string buf;
+  char tmp[8192];
+  while (true) {
+    size_t header_end;
+    while ((header_end = buf.find("\r\n\r\n")) == std::string::npos) {
+      long n = net::recv_some(s, tmp, sizeof(tmp), 10000);
+      if (n <= 0) {
+        net::close_socket(s);
+        return;
+      }
+      buf.append(tmp, (size_t)n);
+    }
+    std::string head = buf.substr(0, header_end);
+    size_t body_len = 0;
+    size_t cl = head.find("Content-Length: ");
+    if (cl != std::string::npos)
+      body_len = std::strtoul(head.c_str() + cl + 16, nullptr, 10);
+    while (buf.size() < header_end + 4 + body_len) {
+      long n = net::recv_some(s, tmp, sizeof(tmp), 10000);
+      if (n <= 0) {
+        net::close_socket(s);
+        return;
+      }
+      buf.append(tmp, (size_t)n);
+    }
+    buf.erase(0, header_end + 4 + body_len);
+
+    bool close_after = head.find(" /close") != std::string::npos;
+    std::string conn = close_after ? "Connection: close\r\n" : "";
+    bool ok;
+    if (head.compare(0, 4, "POST") == 0) {
+      ok = send_str(s, "HTTP/1.1 200 OK\r\nContent-Type: "
+                       "application/x-ndjson\r\nTransfer-Encoding: chunked\r\n" +
+                           conn + "\r\n");
+      for (const char *chunk : CHAT_CHUNKS) {
+        std::string c = chunk;
+        char size[16];
+        std::snprintf(size, sizeof(size), "%zx\r\n", c.size());
+        ok = ok && send_str(s, size + c + "\r\n");
+      }
+      ok = ok && send_str(s, "0\r\n\r\n");
+    } else {
+      ok = send_str(s, "HTTP/1.1 200 OK\r\nContent-Length: 17\r\n" + conn +
+                           "\r\nOllama is running");
+    }
+    if (!ok || close_after) {
+      net::close_socket(s);
+      return;
+    }
+  }
+}
+
+struct Stats {
+  double avg_us, p50_us, p99_us;
+};
+
+static Stats summarize(std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  double sum = 0;
+  for (double x : v)
+    sum += x;
+  return {sum / v.size(), v[v.size() / 2],
+          v[std::min(v.size() - 1, v.size() * 99 / 100)]};
+}
+
+static void run(const char *label, int port, const std::string &prefix,
+                int requests) {
+  std::vector<double> get_us, post_us;
+  std::string body = "{\"model\":\"m\",\"stream\":true,\"messages\":[]}";
+  for (int i = 0; i < requests; ++i) {
+    // A fresh Client per request, like main.cpp does
+    http::Client client("127.0.0.1", port);
+    auto t0 = bench_clock::now();
+    http::Response r1 = client.get(prefix + "/");
+    auto t1 = bench_clock::now();
+    size_t streamed = 0;
+    http::Response r2 = client.post_stream(
+        prefix + "/api/chat", body, [&](const char *, size_t len) {
+          streamed += len;
+          return true;
+        });
+    auto t2 = bench_clock::now();
+    if (r1.status_code != 200 || r2.status_code != 200 || streamed == 0) {
+      std::cerr << "request failed\n";
+      std::exit(1);
+    }
+    get_us.push_back(
+        std::chrono::duration<double, std::micro>(t1 - t0).count());
+    post_us.push_back(
+        std::chrono::duration<double, std::micro>(t2 - t1).count());
+  }
+  Stats g = summarize(get_us), p = summarize(post_us);
+  std::cout << label << "\n  GET /          avg " << (int)g.avg_us
+            << " us, p50 " << (int)g.p50_us << " us, p99 " << (int)g.p99_us
+            << " us\n  POST /api/chat avg " << (int)p.avg_us << " us, p50 "
+            << (int)p.p50_us << " us, p99 " << (int)p.p99_us << " us\n";
+}
+
+int main(int argc, char *argv[]) {
+  int requests = argc > 1 ? std::atoi(argv[1]) : 500;
+  int port = 0;
+  net::socket_t listener = net::listen_tcp("127.0.0.1", 0, &port);
+  if (listener == net::INVALID_SOCKET_VALUE) {
+    std::cerr << "cannot listen\n";
+    return 1;
+  }
+  std::thread([listener] {
+    while (true) {
+      net::socket_t c = net::accept_tcp(listener);
+      if (c == net::INVALID_SOCKET_VALUE)
+        return;
+      std::thread(serve_connection, c).detach();
+    }
+  }).detach();
+
+  run("connection per request", port, "/close", requests);
+  run("keep-alive", port, "", requests);
+  return 0;
+}
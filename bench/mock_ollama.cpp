@@ -0,0 +1,390 @@
+// Mock Ollama server for benchmarks and offline testing. Serves the
+// endpoints ai.exe uses (/, /api/tags, /api/chat, /api/embeddings, /api/ps,
+// plus the OpenAI-compatible /v1/chat/completions) with controllable latency
+// and failures, and can replay a recorded /api/chat stream.
+//
+// Usage: mock_ollama [options]
+//   --port N             listen port (default 11434)
+//   --model NAME         model reported by /api/tags and /api/ps; repeatable
+//   --reply TEXT         assistant reply to generate (default Get-ChildItem)
+//   --replay FILE        replay a recorded /api/chat NDJSON stream, e.g.
+//                        curl -N localhost:11434/api/chat -d @req.json > FILE
+//   --ttft-ms N          delay before the first token (default 0)
+//   --token-delay-ms N   delay between tokens (default 0)
+//   --error-rate P       answer this fraction of requests with HTTP 500
+//   --drop-rate P        close this fraction of chat streams after one token
+//   --verbose            log each request to stderr
+
+#include "json_utils.h"
+#include "tcp_socket.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct MockConfig {
+  int port = 11434;
+  std::vector<std::string> models;
+  std::string reply = "Get-ChildItem -Force";
+  std::vector<std::string> replay_lines; // recorded NDJSON, one per line
+  int ttft_ms = 0;
+  int token_delay_ms = 0;
+  double error_rate = 0;
+  double drop_rate = 0;
+  bool verbose = false;
+};
+
+static MockConfig g_config;
+static std::mutex g_rng_mutex;
+static std::mt19937 g_rng(12345);
+
+static bool roll(double probability) {
+  if (probability <= 0)
+    return false;
+  std::lock_guard<std::mutex> lock(g_rng_mutex);
+  return std::uniform_real_distribution<double>(0, 1)(g_rng) < probability;
+}
+
+static void sleep_ms(int ms) {
+  if (ms > 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+static bool send_str(net::socket_t s, const std::string &data) {
+  return net::send_all(s, data.data(), data.size(), 5000);
+}
+
+static bool send_response(net::socket_t s, int status, const char *type,
+                          const std::string &body) {
+  const char *reason = status == 200 ? "OK"
+                       : status == 404 ? "Not Found"
+                                       : "Internal Server Error";
+  return send_str(s, "HTTP/1.1 " + std::to_string(status) + " " + reason +
+                         "\r\nContent-Type: " + type +
+                         "\r\nContent-Length: " + std::to_string(body.size()) +
+                         "\r\n\r\n" + body);
+}
+
+static bool send_chunk(net::socket_t s, const std::string &data) {
+  char size[16];
+  std::snprintf(size, sizeof(size), "%zx\r\n", data.size());
+  return send_str(s, size + data + "\r\n");
+}
+
+// Splits the reply into token-sized pieces: words with their leading space
+static std::vector<std::string> tokenize(const std::string &text) {
+  std::vector<std::string> tokens;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find(' ', start + 1);
+    if (end == std::string::npos)
+      end = text.size();
+    tokens.push_back(text.substr(start, end - start));
+    start = end;
+  }
+  return tokens;
+}
+
+// Stream lines for the configured reply (or the replayed recording)
+static std::vector<std::string> chat_lines(const std::string &model) {
+  if (!g_config.replay_lines.empty())
+    return g_config.replay_lines;
+
+  std::vector<std::string> lines;
+  std::vector<std::string> tokens = tokenize(g_config.reply);
+  for (const std::string &token : tokens) {
+    json_t line = {{"model", model},
+                   {"message", {{"role", "assistant"}, {"content", token}}},
+                   {"done", false}};
+    lines.push_back(line.dump());
+  }
+  long long eval_ns = (long long)tokens.size() * g_config.token_delay_ms * 1000000;
+  json_t done = {{"model", model},
+                 {"message", {{"role", "assistant"}, {"content", ""}}},
+                 {"done", true},
+                 {"done_reason", "stop"},
+                 {"total_duration", (long long)g_config.ttft_ms * 1000000 + eval_ns},
+                 {"load_duration", 0},
+                 {"prompt_eval_count", 1},
+                 {"prompt_eval_duration", (long long)g_config.ttft_ms * 1000000},
+                 {"eval_count", (long long)tokens.size()},
+                 {"eval_duration", eval_ns}};
+  lines.push_back(done.dump());
+  return lines;
+}
+
+// Folds stream lines into the single object a non-streaming request gets
+static std::string collapse_lines(const std::vector<std::string> &lines) {
+  std::string content;
+  json_t last = json_t::object();
+  for (const std::string &line : lines) {
+    json_t j = json_t::parse(line, nullptr, false);
+    if (j.is_discarded())
+      continue;
+    if (j.contains("message") && j["message"].contains("content"))
+      content += j["message"]["content"].get<std::string>();
+    last = j;
+  }
+  last["message"] = {{"role", "assistant"}, {"content", content}};
+  last["done"] = true;
+  return last.dump();
+}
+
+// Returns false when the connection has to be dropped
+static bool handle_chat(net::socket_t s, const std::string &body) {
+  json_t request = json_t::parse(body, nullptr, false);
+  std::string model = "mock:latest";
+  bool stream = true; // Ollama's default
+  if (!request.is_discarded() && request.is_object()) {
+    if (request.contains("model") && request["model"].is_string())
+      model = request["model"].get<std::string>();
+    if (request.contains("stream") && request["stream"].is_boolean())
+      stream = request["stream"].get<bool>();
+  }
+
+  std::vector<std::string> lines = chat_lines(model);
+  sleep_ms(g_config.ttft_ms);
+  if (!stream)
+    return send_response(s, 200, "application/json", collapse_lines(lines));
+
+  bool drop = roll(g_config.drop_rate);
+  if (!send_str(s, "HTTP/1.1 200 OK\r\nContent-Type: application/x-ndjson\r\n"
+                   "Transfer-Encoding: chunked\r\n\r\n"))
+    return false;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    if (i > 0)
+      sleep_ms(g_config.token_delay_ms);
+    if (!send_chunk(s, lines[i] + "\n"))
+      return false; // client stopped reading
+    if (drop)
+      return false;
+  }
+  return send_str(s, "0\r\n\r\n");
+}
+
+// /v1/chat/completions: the same reply in the OpenAI dialect, streamed as
+// server-sent events
+static bool handle_openai_chat(net::socket_t s, const std::string &body) {
+  json_t request = json_t::parse(body, nullptr, false);
+  std::string model = "mock:latest";
+  bool stream = false; // OpenAI's default
+  if (!request.is_discarded() && request.is_object()) {
+    if (request.contains("model") && request["model"].is_string())
+      model = request["model"].get<std::string>();
+    if (request.contains("stream") && request["stream"].is_boolean())
+      stream = request["stream"].get<bool>();
+  }
+
+  json_t folded = json_t::parse(collapse_lines(chat_lines(model)));
+  std::string content = folded["message"]["content"].get<std::string>();
+  sleep_ms(g_config.ttft_ms);
+  if (!stream) {
+    json_t reply = {
+        {"object", "chat.completion"},
+        {"model", model},
+        {"choices",
+         {{{"index", 0},
+           {"message", {{"role", "assistant"}, {"content", content}}},
+           {"finish_reason", "stop"}}}}};
+    return send_response(s, 200, "application/json", reply.dump());
+  }
+
+  bool drop = roll(g_config.drop_rate);
+  if (!send_str(s, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                   "Transfer-Encoding: chunked\r\n\r\n"))
+    return false;
+  std::vector<std::string> tokens = tokenize(content);
+  for (size_t i = 0; i <= tokens.size(); ++i) {
+    if (i > 0)
+      sleep_ms(g_config.token_delay_ms);
+    bool last = i == tokens.size();
+    json_t chunk = {{"object", "chat.completion.chunk"},
+                    {"model", model},
+                    {"choices",
+                     {{{"index", 0},
+                       {"delta", last ? json_t::object()
+                                      : json_t({{"content", tokens[i]}})},
+                       {"finish_reason", last ? json_t("stop") : json_t()}}}}};
+    if (!send_chunk(s, "data: " + chunk.dump() + "\n\n"))
+      return false;
+    if (drop)
+      return false;
+  }
+  return send_chunk(s, "data: [DONE]\n\n") && send_str(s, "0\r\n\r\n");
+}
+
+static std::string tags_json() {
+  json_t models = json_t::array();
+  for (const std::string &m : g_config.models)
+    models.push_back({{"name", m}, {"model", m}, {"size", 0}});
+  return json_t({{"models", models}}).dump();
+}
+
+static std::string ps_json() {
+  json_t models = json_t::array();
+  for (const std::string &m : g_config.models)
+    models.push_back({{"name", m},
+                      {"model", m},
+                      {"size", 0},
+                      {"size_vram", 0},
+                      {"expires_at", "2099-01-01T00:00:00Z"}});
+  return json_t({{"models", models}}).dump();
+}
+
+// Deterministic 16-dimensional vector derived from the prompt
+static std::string embeddings_json(const std::string &body) {
+  json_t request = json_t::parse(body, nullptr, false);
+  std::string prompt;
+  if (!request.is_discarded() && request.contains("prompt") &&
+      request["prompt"].is_string())
+    prompt = request["prompt"].get<std::string>();
+  unsigned long long h = 1469598103934665603ULL;
+  json_t vec = json_t::array();
+  for (int i = 0; i < 16; ++i) {
+    for (char c : prompt)
+      h = (h ^ (unsigned char)c) * 1099511628211ULL;
+    h = (h ^ (unsigned)i) * 1099511628211ULL;
+    vec.push_back((double)(h % 2001) / 1000.0 - 1.0);
+  }
+  return json_t({{"embedding", vec}}).dump();
+}
+
+// Returns false when the connection has to be closed
+static bool route(net::socket_t s, const std::string &method,
+                  const std::string &path, const std::string &body) {
+  if (g_config.verbose)
+    std::cerr << method << " " << path << "\n";
+  if (path != "/" && roll(g_config.error_rate))
+    return send_response(s, 500, "application/json",
+                         "{\"error\":\"injected failure\"}");
+
+  if (path == "/")
+    return send_response(s, 200, "text/plain", "Ollama is running");
+  if (path == "/api/tags")
+    return send_response(s, 200, "application/json", tags_json());
+  if (path == "/api/ps")
+    return send_response(s, 200, "application/json", ps_json());
+  if (path == "/api/embeddings" && method == "POST")
+    return send_response(s, 200, "application/json", embeddings_json(body));
+  if (path == "/api/chat" && method == "POST")
+    return handle_chat(s, body);
+  if (path == "/v1/chat/completions" && method == "POST")
+    return handle_openai_chat(s, body);
+  return send_response(s, 404, "text/plain", "404 page not found");
+}
+
+// HTTP/1.1 keep-alive loop for one connection
+static void serve_connection(net::socket_t s) {
+  std::string buf;
+  char tmp[8192];
+  while (true) {
+    size_t header_end;
+    while ((header_end = buf.find("\r\n\r\n")) == std::string::npos) {
+      long n = net::recv_some(s, tmp, sizeof(tmp), -1);
+      if (n <= 0) {
+        net::close_socket(s);
+        return;
+      }
+      buf.append(tmp, (size_t)n);
+    }
+    std::string head = buf.substr(0, header_end);
+    size_t body_len = 0;
+    size_t cl = head.find("Content-Length: ");
+    if (cl == std::string::npos)
+      cl = head.find("content-length: ");
+    if (cl != std::string::npos)
+      body_len = std::strtoul(head.c_str() + cl + 16, nullptr, 10);
+    while (buf.size() < header_end + 4 + body_len) {
+      long n = net::recv_some(s, tmp, sizeof(tmp), 30000);
+      if (n <= 0) {
+        net::close_socket(s);
+        return;
+      }
+      buf.append(tmp, (size_t)n);
+    }
+    std::string body = buf.substr(header_end + 4, body_len);
+    buf.erase(0, header_end + 4 + body_len);
+
+    size_t sp1 = head.find(' ');
+    size_t sp2 = head.find(' ', sp1 + 1);
+    if (sp1 == std::string::npos || sp2 == std::string::npos) {
+      net::close_socket(s);
+      return;
+    }
+    std::string method = head.substr(0, sp1);
+    std::string path = head.substr(sp1 + 1, sp2 - sp1 - 1);
+    bool close_after = head.find("Connection: close") != std::string::npos;
+    if (!route(s, method, path, body) || close_after) {
+      net::close_socket(s);
+      return;
+    }
+  }
+}
+
+static bool load_replay(const std::string &path) {
+  std::ifstream f(path);
+  if (!f)
+    return false;
+  std::string line;
+  while (std::getline(f, line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (!line.empty())
+      g_config.replay_lines.push_back(line);
+  }
+  return !g_config.replay_lines.empty();
+}
+
+int main(int argc, char *argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--port" && has_value)
+      g_config.port = std::atoi(argv[++i]);
+    else if (arg == "--model" && has_value)
+      g_config.models.push_back(argv[++i]);
+    else if (arg == "--reply" && has_value)
+      g_config.reply = argv[++i];
+    else if (arg == "--replay" && has_value) {
+      if (!load_replay(argv[++i])) {
+        std::cerr << "cannot read replay file " << argv[i] << "\n";
+        return 1;
+      }
+    } else if (arg == "--ttft-ms" && has_value)
+      g_config.ttft_ms = std::atoi(argv[++i]);
+    else if (arg == "--token-delay-ms" && has_value)
+      g_config.token_delay_ms = std::atoi(argv[++i]);
+    else if (arg == "--error-rate" && has_value)
+      g_config.error_rate = std::atof(argv[++i]);
+    else if (arg == "--drop-rate" && has_value)
+      g_config.drop_rate = std::atof(argv[++i]);
+    else if (arg == "--verbose")
+      g_config.verbose = true;
+    else {
+      std::cerr << "unknown option " << arg << "\n";
+      return 1;
+    }
+  }
+  if (g_config.models.empty())
+    g_config.models.push_back("mock:latest");
+
+  int port = 0;
+  net::socket_t listener = net::listen_tcp("127.0.0.1", g_config.port, &port);
+  if (listener == net::INVALID_SOCKET_VALUE) {
+    std::cerr << "cannot listen on port " << g_config.port << "\n";
+    return 1;
+  }
+  std::cout << "mock_ollama listening on 127.0.0.1:" << port << std::endl;
+  while (true) {
+    net::socket_t c = net::accept_tcp(listener);
+    if (c == net::INVALID_SOCKET_VALUE)
+      return 1;
+    std::thread(serve_connection, c).detach();
+  }
+}
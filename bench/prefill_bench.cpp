@@ -0,0 +1,119 @@
+// Prefill benchmark: compares prompt evaluation time for the legacy prompt
+// layout (per-request hints appended to the system message) against the
+// stable-prefix layout used by main.cpp (static system message, hints after
+// the history). Requires a running Ollama with the given model pulled.
+//
+// Usage: prefill_bench <model> [iterations] [system_prompt.txt]
+
+#include "http_client.h"
+#include "json_utils.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+struct Sample {
+  long long prompt_eval_count = 0;
+  long long prompt_eval_ns = 0;
+  long long total_ns = 0;
+};
+
+static std::string read_file(const std::string &path) {
+  std::ifstream f(path);
+  std::stringstream ss;
+  ss << f.rdbuf();
+  return ss.str();
+}
+
+static bool run_once(const std::string &model, const std::string &system,
+                     const std::string &hints, bool stable_prefix,
+                     const std::string &request, Sample &out) {
+  json::ChatRequestWriter w;
+  w.set_model(model);
+  w.set_stream(false);
+  w.set_keep_alive("30m");
+  // Only prefill matters here; generate a single token
+  w.set_generation_options(1, {});
+  if (stable_prefix) {
+    w.set_system_prompt(system);
+    w.begin();
+    w.add_message("user", "list files");
+    w.add_message("assistant", "Get-ChildItem");
+    w.add_message("system", hints);
+  } else {
+    w.set_system_prompt(system + "\n\n" + hints);
+    w.begin();
+    w.add_message("user", "list files");
+    w.add_message("assistant", "Get-ChildItem");
+  }
+  w.add_message("user", request);
+
+  http::Client client("localhost", 11434);
+  http::Response resp = client.post("/api/chat", w.finish());
+  if (resp.status_code != 200)
+    return false;
+  json::ChatResponse parsed;
+  if (!json::parse_chat_response(resp.body, parsed))
+    return false;
+  out.prompt_eval_count = parsed.timings.prompt_eval_count;
+  out.prompt_eval_ns = parsed.timings.prompt_eval_duration;
+  out.total_ns = parsed.timings.total_duration;
+  return true;
+}
+
+static void report(const char *label, const Sample &sum, int n) {
+  if (n == 0) {
+    std::cout << label << ": no successful runs\n";
+    return;
+  }
+  std::cout << label << ": avg prompt tokens evaluated "
+            << sum.prompt_eval_count / n << ", avg prefill "
+            << sum.prompt_eval_ns / n / 1000000 << " ms, avg total "
+            << sum.total_ns / n / 1000000 << " ms (" << n << " runs)\n";
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cerr << "Usage: prefill_bench <model> [iterations] "
+                 "[system_prompt.txt]\n";
+    return 1;
+  }
+  std::string model = argv[1];
+  int iterations = argc > 2 ? std::stoi(argv[2]) : 5;
+  std::string system = argc > 3 ? read_file(argv[3]) : "";
+  if (system.empty())
+    system = read_file("system_prompt.txt");
+  if (system.empty()) {
+    std::cerr << "system_prompt.txt not found\n";
+    return 1;
+  }
+
+  const char *layouts[] = {"legacy (hints in system)", "stable prefix"};
+  for (int layout = 0; layout < 2; ++layout) {
+    // Warm-up: load the model and seed the KV cache
+    Sample warm;
+    run_once(model, system, "PREVIOUS MISTAKES & FIXES:\n- warm-up",
+             layout == 1, "warm up", warm);
+
+    Sample sum;
+    int ok = 0;
+    for (int i = 0; i < iterations; ++i) {
+      // Hints differ every run, like memory/cache snippets do in practice
+      std::string hints = "CACHED SUCCESSFUL COMMANDS (similar requests):\n"
+                          "- Request: \"open app " +
+                          std::to_string(i) + "\"\n  Command: Start-Process "
+                                              "\"app" +
+                          std::to_string(i) + ".exe\"\n";
+      Sample s;
+      if (run_once(model, system, hints, layout == 1,
+                   "open app " + std::to_string(i), s)) {
+        sum.prompt_eval_count += s.prompt_eval_count;
+        sum.prompt_eval_ns += s.prompt_eval_ns;
+        sum.total_ns += s.total_ns;
+        ok++;
+      }
+    }
+    report(layouts[layout], sum, ok);
+  }
+  return 0;
+}
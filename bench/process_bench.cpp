@@ -0,0 +1,249 @@
+// ProcessRunner benchmark: wall time of a trivial command (dominated by
+// process start-up and how quickly the runner notices the exit), a small
+// program started through the shell and directly (run_program), a trivial
+// PowerShell (bash on POSIX) command started per run and run in a warm
+// ShellHost, time to the first output of a program that buffers its stdout
+// (through pipes and on a pty), and throughput of a command that writes a
+// large amount of output. On POSIX
+// the trivial command is also run with a plain fork/exec/waitpid baseline;
+// ballast-MiB of touched heap makes the cost of fork copying page tables
+// visible (posix_spawn does not).
+//
+// Usage: process_bench [runs] [output-MiB] [ballast-MiB]
+
+#include "process_runner.h"
+#include "shell_host.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using bench_clock = std::chrono::steady_clock;
+
+#ifdef _WIN32
+static const char *TRIVIAL_COMMAND = "cmd /c exit 0";
+static const char *CAT_COMMAND = "cmd /c type ";
+static const char *SHELL_COMMAND =
+    "powershell -NoProfile -ExecutionPolicy Bypass -Command \"Get-Location\"";
+static const char *HOST_SCRIPT = "Get-Location";
+static const ShellHost::Kind HOST_KIND = ShellHost::Kind::powershell;
+static const char *PROGRAM_NAME = "hostname";
+static std::string program_path() {
+  const char *root = std::getenv("SystemRoot");
+  return std::string(root ? root : "C:\\Windows") +
+         "\\System32\\hostname.exe";
+}
+static std::string shell_command(const std::string &program) {
+  return "cmd /c " + program;
+}
+#else
+static const char *TRIVIAL_COMMAND = "true";
+static const char *CAT_COMMAND = "cat ";
+static const char *SHELL_COMMAND = "exec bash -c pwd";
+static const char *HOST_SCRIPT = "pwd";
+static const ShellHost::Kind HOST_KIND = ShellHost::Kind::bash;
+static const char *PROGRAM_NAME = "hostname";
+static std::string program_path() { return "/bin/hostname"; }
+static std::string shell_command(const std::string &program) {
+  return program; // run() hands it to /bin/sh -c
+}
+#endif
+
+static double elapsed_ms(bench_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(bench_clock::now() - start)
+      .count();
+}
+
+static void print_latency(const char *label, std::vector<double> ms) {
+  std::sort(ms.begin(), ms.end());
+  double sum = 0;
+  for (double x : ms)
+    sum += x;
+  size_t runs = ms.size();
+  std::cout << label << ", " << runs << " runs\n  avg " << sum / runs
+            << " ms, p50 " << ms[runs / 2] << " ms, p99 "
+            << ms[std::min(runs - 1, runs * 99 / 100)] << " ms\n";
+}
+
+static void trivial_latency(const char *command, int runs) {
+  std::vector<double> ms;
+  for (int i = 0; i < runs; ++i) {
+    auto start = bench_clock::now();
+    ProcessRunner::Result r = ProcessRunner::run(command);
+    ms.push_back(elapsed_ms(start));
+    if (r.exit_code != 0) {
+      std::cerr << "trivial command failed: " << r.stderr_output << "\n";
+      std::exit(1);
+    }
+  }
+  std::string label = std::string("ProcessRunner (") + command + ")";
+  print_latency(label.c_str(), ms);
+}
+
+static void direct_latency(int runs) {
+  std::vector<double> shell_ms, direct_ms;
+  std::string path = program_path();
+  for (int i = 0; i < runs; ++i) {
+    auto start = bench_clock::now();
+    ProcessRunner::Result r = ProcessRunner::run(shell_command(path));
+    shell_ms.push_back(elapsed_ms(start));
+    start = bench_clock::now();
+    ProcessRunner::Result d = ProcessRunner::run_program(
+        path, {PROGRAM_NAME}, nullptr, ProcessRunner::Options());
+    direct_ms.push_back(elapsed_ms(start));
+    if (r.exit_code != 0 || d.exit_code != 0) {
+      std::cerr << path << " failed: " << r.stderr_output << d.stderr_output
+                << "\n";
+      std::exit(1);
+    }
+  }
+  print_latency(("through the shell (" + shell_command(path) + ")").c_str(),
+                shell_ms);
+  print_latency(("run_program (" + path + ")").c_str(), direct_ms);
+}
+
+// The first run includes the host's start-up and is left out
+static void host_latency(int runs) {
+  ShellHost host(HOST_KIND);
+  std::vector<double> ms;
+  for (int i = 0; i <= runs; ++i) {
+    auto start = bench_clock::now();
+    ProcessRunner::Result r = host.run(HOST_SCRIPT);
+    if (i > 0)
+      ms.push_back(elapsed_ms(start));
+    if (r.exit_code != 0) {
+      std::cerr << "shell host command failed: " << r.stderr_output << "\n";
+      std::exit(1);
+    }
+  }
+  std::string label = std::string("ShellHost (") + HOST_SCRIPT + ")";
+  print_latency(label.c_str(), ms);
+}
+
+// Child mode for first_output: one line, then a while before exiting. stdio
+// buffers a pipe fully but a terminal by line, so through pipes the line
+// only arrives at the exit.
+static const int CHILD_PAUSE_MS = 200;
+
+static int buffered_child() {
+  std::printf(".\n");
+  std::this_thread::sleep_for(std::chrono::milliseconds(CHILD_PAUSE_MS));
+  return 0;
+}
+
+// On the pty the output is shown, as ConPTY expects of it
+static void first_output(const std::string &self, int runs) {
+  for (bool pty : {false, true}) {
+    if (pty && !ProcessRunner::pty_supported())
+      break;
+    std::vector<double> ms;
+    for (int i = 0; i < runs; ++i) {
+      ProcessRunner::Options options;
+      options.pty = pty;
+      auto start = bench_clock::now();
+      double first = -1;
+      ProcessRunner::run(
+          self + " --child",
+          [&](const char *data, size_t len, bool) {
+            if (first < 0)
+              first = elapsed_ms(start);
+            if (pty)
+              std::cout.write(data, len).flush();
+          },
+          options);
+      ms.push_back(first);
+    }
+    print_latency(pty ? "first output, pty" : "first output, pipes", ms);
+  }
+}
+
+#ifndef _WIN32
+// What a naive runner does: fork, exec /bin/sh -c in the child, read the
+// pipe to EOF and reap
+static void fork_baseline(int runs) {
+  std::vector<double> ms;
+  for (int i = 0; i < runs; ++i) {
+    auto start = bench_clock::now();
+    int fds[2];
+    if (pipe(fds) != 0)
+      std::exit(1);
+    pid_t pid = fork();
+    if (pid == 0) {
+      dup2(fds[1], 1);
+      dup2(fds[1], 2);
+      close(fds[0]);
+      close(fds[1]);
+      execl("/bin/sh", "sh", "-c", TRIVIAL_COMMAND, (char *)nullptr);
+      _exit(127);
+    }
+    close(fds[1]);
+    char buf[4096];
+    while (read(fds[0], buf, sizeof(buf)) > 0) {
+    }
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ms.push_back(elapsed_ms(start));
+  }
+  print_latency("fork/exec baseline", ms);
+}
+#endif
+
+static void output_throughput(int mib) {
+  std::string path = "process_bench.tmp";
+  {
+    FILE *f = std::fopen(path.c_str(), "wb");
+    if (!f) {
+      std::cerr << "cannot write " << path << "\n";
+      std::exit(1);
+    }
+    std::string line(99, 'x');
+    line += '\n';
+    for (size_t written = 0; written < (size_t)mib << 20;
+         written += line.size())
+      std::fwrite(line.data(), 1, line.size(), f);
+    std::fclose(f);
+  }
+
+  size_t streamed = 0;
+  auto start = bench_clock::now();
+  ProcessRunner::Result r = ProcessRunner::run(
+      CAT_COMMAND + path,
+      [&](const char *, size_t len, bool) { streamed += len; });
+  double ms = elapsed_ms(start);
+  std::remove(path.c_str());
+  if (r.exit_code != 0 || streamed != r.stdout_info.bytes) {
+    std::cerr << "output command failed: " << r.stderr_output << "\n";
+    std::exit(1);
+  }
+  std::cout << "output throughput, " << (streamed >> 20) << " MiB\n  " << ms
+            << " ms, " << (streamed / 1048576.0) / (ms / 1000) << " MiB/s\n";
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1 && std::string(argv[1]) == "--child")
+    return buffered_child();
+  int runs = argc > 1 ? std::atoi(argv[1]) : 200;
+  int mib = argc > 2 ? std::atoi(argv[2]) : 64;
+  size_t ballast_mib = argc > 3 ? std::atoi(argv[3]) : 0;
+  std::vector<char> ballast(ballast_mib << 20, 1);
+  trivial_latency(TRIVIAL_COMMAND, runs);
+#ifndef _WIN32
+  fork_baseline(runs);
+#endif
+  direct_latency(runs);
+  // PowerShell takes long enough to start that fewer runs will do
+  trivial_latency(SHELL_COMMAND, std::max(1, runs / 10));
+  host_latency(runs);
+  first_output(argv[0], std::max(1, runs / 20));
+  output_throughput(mib);
+  return 0;
+}
@@ -0,0 +1,110 @@
+// Micro-benchmark: serializing a typical /api/chat request with the DOM-based
+// json::Builder versus the single-pass json::ChatRequestWriter. No network.
+//
+// Usage: request_writer_bench [iterations]
+
+#include "json_utils.h"
+#include <chrono>
+#include <iostream>
+#include <string>
+
+using bench_clock = std::chrono::steady_clock;
+
+// Old main.cpp path: substr copies per transcript segment, then build()
+static void load_history_builder(json::Builder &builder,
+                                 const std::string &transcript) {
+  size_t pos = 0;
+  while (pos < transcript.length()) {
+    size_t next_sep = transcript.find("|||", pos);
+    if (next_sep == std::string::npos)
+      break;
+    std::string segment = transcript.substr(pos, next_sep - pos);
+    const char *ws = " \t\n\r\f\v";
+    segment.erase(0, segment.find_first_not_of(ws));
+    segment.erase(segment.find_last_not_of(ws) + 1);
+    if (segment.find("USER: ") == 0)
+      builder.add_message("user", segment.substr(6));
+    else if (segment.find("ASSISTANT: ") == 0)
+      builder.add_message("assistant", segment.substr(11));
+    pos = next_sep + 3;
+  }
+}
+
+static void load_history_writer(json::ChatRequestWriter &writer,
+                                std::string_view transcript) {
+  const char *ws = " \t\n\r\f\v";
+  size_t pos = 0;
+  while (pos < transcript.length()) {
+    size_t next_sep = transcript.find("|||", pos);
+    if (next_sep == std::string_view::npos)
+      break;
+    std::string_view segment = transcript.substr(pos, next_sep - pos);
+    size_t first = segment.find_first_not_of(ws);
+    segment = first == std::string_view::npos
+                  ? std::string_view()
+                  : segment.substr(first,
+                                   segment.find_last_not_of(ws) - first + 1);
+    if (segment.substr(0, 6) == "USER: ")
+      writer.add_message("user", segment.substr(6));
+    else if (segment.substr(0, 11) == "ASSISTANT: ")
+      writer.add_message("assistant", segment.substr(11));
+    pos = next_sep + 3;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? std::stoi(argv[1]) : 20000;
+
+  // Roughly the size of system_prompt.txt plus env block
+  std::string system_prompt;
+  while (system_prompt.size() < 4000)
+    system_prompt += "- Use `Get-ChildItem` with \"-Recurse\" and wildcards\n";
+  std::string transcript;
+  for (int i = 0; i < 5; ++i) {
+    transcript += "USER: open app number " + std::to_string(i) +
+                  " ||| ASSISTANT: Start-Process \"App" + std::to_string(i) +
+                  ".exe\" -ErrorAction SilentlyContinue ||| RESULT: "
+                  "[SUCCESS] ||| ";
+  }
+  std::string hints = "PREVIOUS MISTAKES & FIXES:\n- Failed: foo\n  Fix: bar\n";
+  std::string request = "list the five largest files in Downloads";
+
+  size_t sink = 0;
+
+  auto t0 = bench_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    json::Builder b;
+    b.add("model", std::string("codellama:latest"));
+    b.add("stream", true);
+    b.add_message("system", system_prompt);
+    load_history_builder(b, transcript);
+    b.add_message("system", hints);
+    b.add_message("user", request);
+    sink += b.build().size();
+  }
+  auto t1 = bench_clock::now();
+
+  json::ChatRequestWriter w;
+  w.set_model("codellama:latest");
+  w.set_stream(true);
+  w.set_keep_alive("30m");
+  w.set_generation_options(384, {"\n\n"});
+  w.set_system_prompt(system_prompt);
+  for (int i = 0; i < iterations; ++i) {
+    w.begin();
+    load_history_writer(w, transcript);
+    w.add_message("system", hints);
+    w.add_message("user", request);
+    sink += w.finish().size();
+  }
+  auto t2 = bench_clock::now();
+
+  auto ns = [&](bench_clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() /
+           iterations;
+  };
+  std::cout << "json::Builder:           " << ns(t1 - t0) << " ns/request\n";
+  std::cout << "json::ChatRequestWriter: " << ns(t2 - t1) << " ns/request\n";
+  std::cout << "(checksum " << sink << ")\n";
+  return 0;
+}
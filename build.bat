@@ -6,20 +6,32 @@ set OUT_DIR=%~dp0bin
 if not exist "%OUT_DIR%" mkdir "%OUT_DIR%"
 del /Q "%OUT_DIR%\ai.exe" 2>nul
 
+rem "build.bat sockets" selects the socket HTTP backend instead of WinHTTP
+set EXTRA_FLAGS=
+if /I "%~1"=="sockets" set EXTRA_FLAGS=-DAI_SHELL_HTTP_SOCKETS
 
 echo Building ai.exe...
 
-g++ -o "%OUT_DIR%\ai.exe" -I "%SRC_DIR%" ^
+g++ -o "%OUT_DIR%\ai.exe" -I "%SRC_DIR%" %EXTRA_FLAGS% ^
     "%SRC_DIR%\main.cpp" ^
     "%SRC_DIR%\json_utils.cpp" ^
     "%SRC_DIR%\http_client.cpp" ^
+    "%SRC_DIR%\http_client_winhttp.cpp" ^
+    "%SRC_DIR%\http_client_socket.cpp" ^
+    "%SRC_DIR%\tcp_socket.cpp" ^
+    "%SRC_DIR%\llm_router.cpp" ^
     "%SRC_DIR%\context_manager.cpp" ^
     "%SRC_DIR%\wrapper.cpp" ^
     "%SRC_DIR%\command_processor.cpp" ^
     "%SRC_DIR%\memory.cpp" ^
     "%SRC_DIR%\process_runner.cpp" ^
+    "%SRC_DIR%\process_runner_posix.cpp" ^
+    "%SRC_DIR%\shell_host.cpp" ^
+    "%SRC_DIR%\path_resolver.cpp" ^
+    "%SRC_DIR%\plan_executor.cpp" ^
+    "%SRC_DIR%\output_capture.cpp" ^
     "%SRC_DIR%\command_cache.cpp" ^
-    -lwinhttp -static-libgcc -static-libstdc++
+    -lwinhttp -lws2_32 -lpsapi -static-libgcc -static-libstdc++
     
 copy /Y "%~dp0system_prompt.txt" "%OUT_DIR%\" >nul 2>&1
 
@@ -5,6 +5,9 @@
 $AiExePath = Join-Path $PSScriptRoot "bin\ai.exe"
 $Global:AiShellUsedSession = $false
 
+# One conversation history per terminal, even when several run ai at once
+$env:AI_SHELL_SESSION = "ps-$PID"
+
 # Wrapper function to track usage
 function Global:ai {
     $Global:AiShellUsedSession = $true
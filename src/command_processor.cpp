@@ -1,8 +1,18 @@
 #include "command_processor.h"
+#include "path_resolver.h"
 #include "process_runner.h"
+#include "shell_host.h"
 #include <algorithm>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <utility>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 bool is_interactive_tool(const std::string &cmd) {
   std::string lower = cmd;
@@ -49,6 +59,125 @@ std::string wrap_powershell(const std::string &cmd) {
          "\"";
 }
 
+// Generated commands use the user's dialect; sh may be dash
+static bool user_shell_is_bash() {
+  const char *shell = std::getenv("SHELL");
+  std::string name = shell ? shell : "";
+  name.erase(0, name.find_last_of('/') + 1);
+  return name == "bash";
+}
+
+std::string wrap_posix_shell(const std::string &cmd) {
+  std::string quoted = "'";
+  for (char c : cmd) {
+    if (c == '\'')
+      quoted += "'\\''";
+    else
+      quoted += c;
+  }
+  quoted += "'";
+
+  if (is_likely_powershell(cmd))
+    return "exec pwsh -NoProfile -Command " + quoted;
+  if (user_shell_is_bash())
+    return "exec bash -c " + quoted;
+  return cmd;
+}
+
+// Commands the shell runs itself; as a program on PATH they would do
+// something else, or nothing (cd)
+#ifdef _WIN32
+static const char *const SHELL_BUILTINS[] = {
+    "assoc", "break",  "call",     "cd",     "chdir", "cls",    "color",
+    "copy",  "date",   "del",      "dir",    "echo",  "endlocal", "erase",
+    "exit",  "for",    "ftype",    "goto",   "if",    "md",     "mkdir",
+    "mklink", "move",  "path",     "pause",  "popd",  "prompt", "pushd",
+    "rd",    "rem",    "ren",      "rename", "rmdir", "set",    "setlocal",
+    "shift", "start",  "time",     "title",  "type",  "ver",    "verify",
+    "vol"};
+#else
+static const char *const SHELL_BUILTINS[] = {
+    "alias",   "bg",      "bind",    "break",   "builtin", "case",
+    "cd",      "command", "continue", "coproc", "declare", "dirs",
+    "disown",  "do",      "done",    "echo",    "elif",    "else",
+    "enable",  "esac",    "eval",    "exec",    "exit",    "export",
+    "false",   "fc",      "fg",      "fi",      "for",     "function",
+    "getopts", "hash",    "help",    "history", "if",      "jobs",
+    "kill",    "let",     "local",   "logout",  "popd",    "printf",
+    "pushd",   "pwd",     "read",    "readonly", "return", "select",
+    "set",     "shift",   "shopt",   "source",  "suspend", "test",
+    "then",    "time",    "times",   "trap",    "true",    "type",
+    "typeset", "ulimit",  "umask",   "unalias", "unset",   "until",
+    "wait",    "while"};
+#endif
+
+bool split_simple_command(const std::string &cmd,
+                          std::vector<std::string> &words) {
+  words.clear();
+#ifdef _WIN32
+  // Interpreted by cmd.exe; % and ! even inside quotes
+  const char *special = "&|<>^%!()\r\n";
+  const char *special_quoted = "%!\r\n";
+  const char *quotes = "\"";
+  // \" is an escaped quote to the program but not to cmd
+  if (cmd.find("\\\"") != std::string::npos)
+    return false;
+#else
+  const char *special = "&|;<>()$`\\*?[]{}~#!\r\n";
+  const char *special_quoted = "$`\\!\r\n"; // inside double quotes
+  const char *quotes = "\"'";
+#endif
+  std::string word;
+  bool in_word = false;
+  char quote = 0;
+  for (char c : cmd) {
+    if (quote) {
+      if (c == quote)
+        quote = 0;
+      else if (quote == '"' && std::strchr(special_quoted, c))
+        return false;
+      else
+        word += c;
+      continue;
+    }
+    if (c == ' ' || c == '\t') {
+      if (in_word)
+        words.push_back(word);
+      word.clear();
+      in_word = false;
+      continue;
+    }
+    if (c == '\0' || std::strchr(special, c))
+      return false;
+    in_word = true;
+    if (std::strchr(quotes, c))
+      quote = c;
+    else
+      word += c;
+  }
+  if (quote)
+    return false;
+  if (in_word)
+    words.push_back(word);
+  if (words.empty())
+    return false;
+
+  std::string name = words[0];
+#ifdef _WIN32
+  std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+  if (name[0] == '@')
+    return false;
+#else
+  if (name.find('=') != std::string::npos)
+    return false; // VAR=value prefix
+#endif
+  for (const char *builtin : SHELL_BUILTINS) {
+    if (name == builtin)
+      return false;
+  }
+  return true;
+}
+
 std::string sanitize_command(const std::string &raw_cmd) {
   std::string sanitized = raw_cmd;
   std::string lower_cmd = raw_cmd;
@@ -84,8 +213,196 @@ std::string sanitize_command(const std::string &raw_cmd) {
   return sanitized;
 }
 
-int execute_command_safely(const std::string &cmd,
-                           const std::string &stderr_path) {
+size_t find_command_end(const std::string &reply) {
+  const char *ws = " \t\n\r\f\v";
+  size_t start = reply.find_first_not_of(ws);
+  if (start == std::string::npos)
+    return std::string::npos;
+
+  if (reply.compare(start, 3, "```") == 0) {
+    size_t body = reply.find('\n', start);
+    if (body == std::string::npos)
+      return std::string::npos;
+    size_t close = reply.find("```", body);
+    if (close == std::string::npos)
+      return std::string::npos;
+    return close + 3;
+  }
+
+  size_t line_start = start;
+  while (true) {
+    size_t eol = reply.find('\n', line_start);
+    if (eol == std::string::npos)
+      return std::string::npos;
+
+    std::string line = reply.substr(line_start, eol - line_start);
+    line.erase(line.find_last_not_of(ws) + 1);
+    std::string lower = line;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    if (!line.empty() && lower != "powershell" && lower != "pwsh" &&
+        lower != "ps1" && lower != "bash" && lower != "sh" && lower != "cmd")
+      return eol;
+
+    line_start = eol + 1;
+  }
+}
+
+CapturePolicy capture_policy_from_env() {
+  CapturePolicy policy;
+  const char *kib = std::getenv("AI_SHELL_CAPTURE_KIB");
+  if (kib && std::atoi(kib) > 0)
+    policy.head_bytes = policy.tail_bytes = (size_t)std::atoi(kib) * 1024;
+  policy.spill = std::getenv("AI_SHELL_SPILL_OUTPUT") != nullptr;
+  return policy;
+}
+
+ProcessRunner::Options run_options_from_env() {
+  ProcessRunner::Options options;
+  options.capture = capture_policy_from_env();
+  const char *sec = std::getenv("AI_SHELL_TIMEOUT_SEC");
+  if (sec && std::atoi(sec) > 0)
+    options.wall_limit_ms = std::atoi(sec) * 1000;
+  const char *cpu = std::getenv("AI_SHELL_CPU_LIMIT_SEC");
+  if (cpu && std::atoi(cpu) > 0)
+    options.cpu_limit_ms = std::atoi(cpu) * 1000;
+  const char *mb = std::getenv("AI_SHELL_MEMORY_LIMIT_MB");
+  if (mb && std::atoi(mb) > 0)
+    options.memory_limit_bytes = (uint64_t)std::atoi(mb) << 20;
+  return options;
+}
+
+// Whether cmd runs on a pseudo-terminal: AI_SHELL_PTY=1 for every command,
+// 0 for none; by default the interactive tools, when ai itself was started
+// from a terminal
+static bool wants_pty(const std::string &cmd) {
+  if (!ProcessRunner::pty_supported())
+    return false;
+  const char *setting = std::getenv("AI_SHELL_PTY");
+  if (setting && *setting)
+    return std::atoi(setting) != 0;
+#ifdef _WIN32
+  bool terminal = _isatty(_fileno(stdin)) && _isatty(_fileno(stdout));
+#else
+  bool terminal = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+#endif
+  return terminal && is_interactive_tool(cmd);
+}
+
+// The warm shell host cmd runs in, or nullptr when it gets a process of
+// its own: the host is turned off, a limit must be able to stop it, it
+// needs a terminal, or its shell has no host (cmd.exe, sh, pwsh outside
+// Windows)
+static ShellHost *shell_host_for(const std::string &cmd,
+                                 const ProcessRunner::Options &options) {
+  if (std::getenv("AI_SHELL_NO_SHELL_HOST") || options.wall_limit_ms > 0 ||
+      options.cpu_limit_ms > 0 || options.memory_limit_bytes > 0 ||
+      options.pty)
+    return nullptr;
+#ifdef _WIN32
+  if (!is_likely_powershell(cmd))
+    return nullptr;
+  ShellHost &host = ShellHost::shared(ShellHost::Kind::powershell);
+#else
+  if (is_likely_powershell(cmd) || !user_shell_is_bash())
+    return nullptr;
+  ShellHost &host = ShellHost::shared(ShellHost::Kind::bash);
+#endif
+  return host.start() ? &host : nullptr;
+}
+
+// Whether cmd can skip the shell: a simple command whose program is found
+// on PATH. GUI programs still go through cmd, which does not wait for them.
+// Resolved programs are cached in cache_dir.
+static bool find_direct_program(const std::string &cmd,
+                                const std::string &cache_dir,
+                                std::vector<std::string> &words,
+                                PathResolver::Program &program) {
+  if (std::getenv("AI_SHELL_NO_DIRECT_EXEC") || is_likely_powershell(cmd) ||
+      !split_simple_command(cmd, words))
+    return false;
+  static PathResolver resolver(cache_dir + "path_cache.json");
+  return resolver.resolve(words[0], program) && !program.gui;
+}
+
+void prestart_shell_host() {
+#ifdef _WIN32
+  shell_host_for("Get-Location", run_options_from_env());
+#else
+  shell_host_for("true", run_options_from_env());
+#endif
+}
+
+// How much of a command's stderr is searched for a failure signature while
+// it runs; a failure worth reacting to early shows up at the start
+static const size_t EARLY_STDERR_BYTES = 16384;
+
+std::string find_failure_signature(const std::string &stderr_text) {
+  static const char *const SIGNATURES[] = {
+      // PowerShell and cmd
+      "is not recognized as",
+      "Cannot find path",
+      "ParserError",
+      "The system cannot find the path specified",
+      "The system cannot find the file specified",
+      // bash and dash
+      "command not found",
+      ": not found",
+      "syntax error near unexpected token",
+  };
+  size_t line_start = 0;
+  while (true) {
+    size_t eol = stderr_text.find('\n', line_start);
+    if (eol == std::string::npos)
+      return "";
+    std::string line = stderr_text.substr(line_start, eol - line_start);
+    for (const char *signature : SIGNATURES) {
+      if (line.find(signature) != std::string::npos) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        return line;
+      }
+    }
+    line_start = eol + 1;
+  }
+}
+
+std::string shell_command_line(const std::string &sanitized) {
+#ifdef _WIN32
+  if (is_likely_powershell(sanitized))
+    return wrap_powershell(sanitized);
+  // For ProcessRunner via CreateProcess, we usually need "cmd /c" if it's a
+  // shell builtin or just the command if it's an exe. Since we want to
+  // support everything safely: If it's NOT powershell, we assume cmd.exe for
+  // broad compatibility (dir, type, echo, etc.)
+  return "cmd /c " + sanitized;
+#else
+  return wrap_posix_shell(sanitized);
+#endif
+}
+
+std::string termination_message(const ProcessRunner::Result &result,
+                                const ProcessRunner::Options &options) {
+  switch (result.termination) {
+  case ProcessRunner::Termination::wall_timeout:
+    return "Command timed out after " +
+           std::to_string(options.wall_limit_ms / 1000) +
+           " s and was stopped.";
+  case ProcessRunner::Termination::cpu_timeout:
+    return "Command used more than " +
+           std::to_string(options.cpu_limit_ms / 1000) +
+           " s of CPU time and was stopped.";
+  case ProcessRunner::Termination::memory_limit:
+    return "Command exceeded the " +
+           std::to_string(options.memory_limit_bytes >> 20) +
+           " MB memory limit and was stopped.";
+  default:
+    return "";
+  }
+}
+
+int execute_command_safely(
+    const std::string &cmd, const std::string &stderr_path,
+    ProcessRunner::Result *run,
+    const std::function<void(const std::string &)> &on_failure) {
   std::string sanitized = sanitize_command(cmd);
 
   // Filter "echo" explanations that look like failure messages
@@ -98,30 +415,65 @@ int execute_command_safely(const std::string &cmd,
     }
   }
 
-  std::string final_cmd;
-  if (is_likely_powershell(sanitized)) {
-    final_cmd = wrap_powershell(sanitized);
-  } else {
-    // For ProcessRunner via CreateProcess, we usually need "cmd /c" if it's a
-    // shell builtin or just the command if it's an exe. Since we want to
-    // support everything safely: If it's NOT powershell, we assume cmd.exe for
-    // broad compatibility (dir, type, echo, etc.)
-    final_cmd = "cmd /c " + sanitized;
-  }
-
-  // Use ProcessRunner with streaming callback
-  ProcessRunner::Result result = ProcessRunner::run(
-      final_cmd, [](const char *data, size_t len, bool is_stderr) {
-        if (is_stderr) {
-          std::cerr.write(data, len);
-          std::cerr.flush();
-        } else {
-          std::cout.write(data, len);
-          std::cout.flush();
-        }
-      });
-
-  // Stdout already printed via callback
+  std::string final_cmd = shell_command_line(sanitized);
+
+  // Start the program directly if no shell is needed, else run in the warm
+  // shell host if there is one, else start the shell; output streams to the
+  // terminal either way. The start of stderr is also checked for a
+  // failure signature while the command runs (there is no separate stderr
+  // on a pty).
+  ProcessRunner::Options options = run_options_from_env();
+  options.pty = wants_pty(sanitized);
+  std::string early_stderr;
+  bool failure_seen = false;
+  auto print = [&](const char *data, size_t len, bool is_stderr) {
+    if (is_stderr) {
+      std::cerr.write(data, len);
+      std::cerr.flush();
+    } else {
+      std::cout.write(data, len);
+      std::cout.flush();
+    }
+    if (!is_stderr || !on_failure || failure_seen ||
+        early_stderr.size() >= EARLY_STDERR_BYTES)
+      return;
+    early_stderr.append(data,
+                        std::min(len, EARLY_STDERR_BYTES - early_stderr.size()));
+    if (!find_failure_signature(early_stderr).empty()) {
+      failure_seen = true;
+      on_failure(early_stderr);
+    }
+  };
+  std::vector<std::string> words;
+  PathResolver::Program program;
+  // The cache sits next to the stderr log, in bin/
+  std::string cache_dir =
+      stderr_path.substr(0, stderr_path.find_last_of("\\/") + 1);
+  ShellHost *host = nullptr;
+  ProcessRunner::Result result;
+  if (find_direct_program(sanitized, cache_dir, words, program))
+    result = ProcessRunner::run_program(program.path, words, print, options);
+  else if ((host = shell_host_for(sanitized, options)))
+    result = host->run(sanitized, print, options.capture);
+  else
+    result = ProcessRunner::run(final_cmd, print, options);
+
+  // Stdout already printed via callback. Only the head and tail of long
+  // output are kept; say where the rest went if it was spilled.
+  for (const CaptureInfo *info : {&result.stdout_info, &result.stderr_info}) {
+    if (!info->spill_path.empty())
+      std::cerr << "\033[90m[Full output (" << info->bytes
+                << " bytes): " << info->spill_path << "]\033[0m\n";
+  }
+
+  // A stopped command says so in its stderr, so the fix request sees why
+  std::string stopped = termination_message(result, options);
+  if (!stopped.empty()) {
+    std::cerr << "\033[31m[" << stopped << "]\033[0m\n";
+    if (!result.stderr_output.empty() && result.stderr_output.back() != '\n')
+      result.stderr_output += '\n';
+    result.stderr_output += stopped + "\n";
+  }
 
   // Write Stderr to file for Main's analysis (keep compatibility with main.cpp
   // logic)
@@ -142,6 +494,7 @@ int execute_command_safely(const std::string &cmd,
       fclose(f);
   }
 
+#ifdef _WIN32
   // Improved clip piping: Escape quotes for CMD echo
   std::string clip_payload = sanitized;
   std::string escaped_for_echo;
@@ -154,6 +507,10 @@ int execute_command_safely(const std::string &cmd,
 
   // Clip still uses system for simplicity, or we could use ProcessRunner too
   std::system(("echo \"" + escaped_for_echo + "\" | clip").c_str());
+#endif
 
-  return result.exit_code;
+  int exit_code = result.exit_code;
+  if (run)
+    *run = std::move(result);
+  return exit_code;
 }
@@ -1,7 +1,10 @@
 #ifndef COMMAND_PROCESSOR_H
 #define COMMAND_PROCESSOR_H
 
+#include "process_runner.h"
+#include <functional>
 #include <string>
+#include <vector>
 
 // Checks if the command is for an interactive tool (sqlite, python, etc.)
 bool is_interactive_tool(const std::string &cmd);
@@ -12,14 +15,69 @@ bool is_likely_powershell(const std::string &cmd);
 // Wraps a command in powershell -c "..." handling quoting
 std::string wrap_powershell(const std::string &cmd);
 
+// POSIX counterpart of the cmd /c / wrap_powershell choice: the command line
+// for /bin/sh -c that runs cmd under pwsh if it looks like PowerShell, under
+// bash if that is the user's $SHELL, otherwise under sh itself
+std::string wrap_posix_shell(const std::string &cmd);
+
+// The shell command line that runs a sanitized command: cmd /c, or
+// wrap_powershell for PowerShell, on Windows; wrap_posix_shell elsewhere
+std::string shell_command_line(const std::string &sanitized);
+
+// Splits cmd into words if it is a plain program invocation that needs no
+// shell: no pipes, redirections, variables, globs or other characters the
+// shell (cmd.exe on Windows, sh elsewhere) would interpret, and not a shell
+// builtin. Double quotes (and single quotes on POSIX) group a word and are
+// removed. false otherwise.
+bool split_simple_command(const std::string &cmd,
+                          std::vector<std::string> &words);
+
 // Main sanitization function to clean up AI output
 // Strips outer quotes, handles nested powershell wrapping, etc.
 std::string sanitize_command(const std::string &raw_cmd);
 
+// Finds where the single-line command in a (possibly partial) model reply
+// ends: after the first non-empty line, or after the closing ``` when the
+// reply opens with a code fence. A bare language tag line ("powershell") does
+// not count. Returns std::string::npos while the command is still incomplete.
+size_t find_command_end(const std::string &reply);
+
+// Output capture limits for executed commands: AI_SHELL_CAPTURE_KIB sets the
+// head and tail kept of each stream, AI_SHELL_SPILL_OUTPUT keeps the full
+// stream in a temp file when it is longer
+CapturePolicy capture_policy_from_env();
+
+// Runner options for executed commands: the capture policy above plus the
+// limits AI_SHELL_TIMEOUT_SEC (wall clock), AI_SHELL_CPU_LIMIT_SEC and
+// AI_SHELL_MEMORY_LIMIT_MB; unset means no limit
+ProcessRunner::Options run_options_from_env();
+
+// Why a limit in options stopped the command, or empty if it exited on its
+// own
+std::string termination_message(const ProcessRunner::Result &result,
+                                 const ProcessRunner::Options &options);
+
+// Starts the shell host the next command most likely runs in (PowerShell
+// on Windows, bash where that is $SHELL), so that its start-up overlaps the
+// model request. Commands of that shell then skip starting one; see
+// ShellHost. AI_SHELL_NO_SHELL_HOST turns this off.
+void prestart_shell_host();
+
+// The stderr line that shows a command has certainly failed, or empty:
+// "not recognized" and "cannot find path" errors from PowerShell and cmd,
+// "command not found" and syntax errors from POSIX shells. Only complete
+// lines are looked at.
+std::string find_failure_signature(const std::string &stderr_text);
+
 // Helper to safely execute the command (wrapping if needed)
-// Returns exit code
+// Returns exit code; run, if given, receives the output and resource usage
+// (left untouched when the command was suppressed and never ran).
+// on_failure, if given, is called at most once while the command still
+// runs, as soon as its stderr so far (passed in) has a failure signature.
 int execute_command_safely(
     const std::string &cmd,
-    const std::string &stderr_path = "terminal_stderr.log");
+    const std::string &stderr_path = "terminal_stderr.log",
+    ProcessRunner::Result *run = nullptr,
+    const std::function<void(const std::string &)> &on_failure = nullptr);
 
 #endif // COMMAND_PROCESSOR_H
@@ -1,47 +1,202 @@
 #include "context_manager.h"
 #include "json_utils.h"
+#include <chrono>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <sstream>
 
-ContextManager::ContextManager(const std::string &file_path)
-    : file_path(file_path) {}
+#ifdef _WIN32
+#include <windows.h>
+#include <tlhelp32.h>
+#else
+#include <unistd.h>
+#endif
 
-bool ContextManager::exists() {
-  std::ifstream f(file_path.c_str());
-  return f.good();
-}
+namespace fs = std::filesystem;
 
-bool ContextManager::load_context(AiContext &context) {
-  if (!exists())
-    return false;
-  std::ifstream t(file_path);
+// Keep the model resident between invocations so its KV cache survives
+static const char *DEFAULT_KEEP_ALIVE = "30m";
+
+// Session files untouched for this long belong to closed terminals
+static const int STALE_SESSION_DAYS = 7;
+
+static std::string read_file(const std::string &path) {
+  std::ifstream t(path, std::ios::binary);
+  if (!t)
+    return "";
   std::stringstream buffer;
   buffer << t.rdbuf();
-  std::string content = buffer.str();
+  return buffer.str();
+}
 
-  auto map = json::parse_simple_object(content);
-  context.operating_mode = map["operating_mode"];
-  context.model_name = map["model_name"];
-  context.env_block = map["env_block"];
-  context.transcript = map["transcript"];
+ContextManager::ContextManager(const std::string &base_dir)
+    : base_dir(base_dir) {
+  session = detect_session_id();
+  settings_path = base_dir + "settings.json";
+  session_path = base_dir + "sessions/" + session + ".json";
+}
+
+std::string ContextManager::detect_session_id() {
+  std::string id;
+  const char *env = std::getenv("AI_SHELL_SESSION");
+  if (env && *env) {
+    id = env;
+  } else {
+#ifdef _WIN32
+    // Parent of ai.exe is the shell that launched it
+    DWORD pid = GetCurrentProcessId();
+    HANDLE snap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (snap != INVALID_HANDLE_VALUE) {
+      PROCESSENTRY32 pe;
+      pe.dwSize = sizeof(pe);
+      if (Process32First(snap, &pe)) {
+        do {
+          if (pe.th32ProcessID == pid) {
+            id = "pid-" + std::to_string(pe.th32ParentProcessID);
+            break;
+          }
+        } while (Process32Next(snap, &pe));
+      }
+      CloseHandle(snap);
+    }
+#else
+    id = "pid-" + std::to_string(getppid());
+#endif
+  }
+  if (id.empty())
+    return "default";
 
+  // Used as a file name
+  for (char &c : id) {
+    if (!std::isalnum((unsigned char)c) && c != '-' && c != '_')
+      c = '_';
+  }
+  return id;
+}
+
+bool ContextManager::write_atomic(const std::string &path,
+                                  const std::string &data) {
+#ifdef _WIN32
+  std::string tmp_path = path + ".tmp" + std::to_string(GetCurrentProcessId());
+#else
+  std::string tmp_path = path + ".tmp" + std::to_string(getpid());
+#endif
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return false;
+    out << data;
+    out.flush();
+    if (!out) {
+      out.close();
+      std::remove(tmp_path.c_str());
+      return false;
+    }
+  }
+#ifdef _WIN32
+  BOOL ok = MoveFileExA(tmp_path.c_str(), path.c_str(),
+                        MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+  bool ok = std::rename(tmp_path.c_str(), path.c_str()) == 0;
+#endif
+  if (!ok) {
+    std::remove(tmp_path.c_str());
+    return false;
+  }
   return true;
 }
 
-bool ContextManager::save_context(const AiContext &context) {
+std::string ContextManager::serialize_settings(const AiContext &context) const {
   json::Builder builder;
   builder.add("operating_mode", context.operating_mode);
   builder.add("model_name", context.model_name);
   builder.add("env_block", context.env_block);
-  builder.add("transcript", context.transcript);
+  builder.add("keep_alive", context.keep_alive);
+  return builder.build();
+}
+
+// Split a pre-session context.json into settings.json plus this session
+bool ContextManager::migrate_legacy_context() {
+  std::string legacy_path = base_dir + "context.json";
+  std::string content = read_file(legacy_path);
+  if (content.empty())
+    return false;
+
+  auto map = json::parse_simple_object(content);
+  AiContext ctx;
+  ctx.operating_mode = map["operating_mode"];
+  ctx.model_name = map["model_name"];
+  ctx.env_block = map["env_block"];
+  ctx.keep_alive = map["keep_alive"];
+  ctx.transcript = map["transcript"];
+  if (ctx.keep_alive.empty())
+    ctx.keep_alive = DEFAULT_KEEP_ALIVE;
 
-  std::string content = builder.build();
-  std::ofstream out(file_path);
-  if (!out)
+  if (!save_context(ctx))
     return false;
-  out << content;
-  out.close();
+  std::remove(legacy_path.c_str());
   return true;
 }
 
-void ContextManager::clear_context() { std::remove(file_path.c_str()); }
+void ContextManager::prune_stale_sessions() {
+  std::error_code ec;
+  auto now = fs::file_time_type::clock::now();
+  auto max_age = std::chrono::hours(24 * STALE_SESSION_DAYS);
+  for (const auto &entry : fs::directory_iterator(base_dir + "sessions", ec)) {
+    auto mtime = entry.last_write_time(ec);
+    if (!ec && now - mtime > max_age)
+      fs::remove(entry.path(), ec);
+  }
+}
+
+bool ContextManager::exists() {
+  std::ifstream f(settings_path.c_str());
+  return f.good();
+}
+
+bool ContextManager::load_context(AiContext &context) {
+  if (!exists() && !migrate_legacy_context())
+    return false;
+
+  auto settings = json::parse_simple_object(read_file(settings_path));
+  context.operating_mode = settings["operating_mode"];
+  context.model_name = settings["model_name"];
+  context.env_block = settings["env_block"];
+  context.keep_alive = settings["keep_alive"];
+  if (context.keep_alive.empty())
+    context.keep_alive = DEFAULT_KEEP_ALIVE;
+  loaded_settings = serialize_settings(context);
+
+  // A missing session file just means a fresh terminal
+  auto session_map = json::parse_simple_object(read_file(session_path));
+  context.transcript = session_map["transcript"];
+
+  return true;
+}
+
+bool ContextManager::save_context(const AiContext &context) {
+  std::string settings = serialize_settings(context);
+  if (settings != loaded_settings) {
+    if (!write_atomic(settings_path, settings))
+      return false;
+    loaded_settings = settings;
+  }
+
+  std::error_code ec;
+  fs::path sessions_dir = base_dir + "sessions";
+  if (!fs::exists(sessions_dir, ec)) {
+    fs::create_directories(sessions_dir, ec);
+  } else if (!fs::exists(session_path, ec)) {
+    // First write of a new session: good moment to drop abandoned ones
+    prune_stale_sessions();
+  }
+
+  json::Builder builder;
+  builder.add("transcript", context.transcript);
+  return write_atomic(session_path, builder.build());
+}
+
+void ContextManager::clear_context() { std::remove(session_path.c_str()); }
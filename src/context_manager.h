@@ -9,19 +9,43 @@ struct AiContext {
   std::string model_name;
   std::string env_block;
   std::string transcript;
+  // Ollama keep_alive value sent with every chat request ("30m", "-1", ...)
+  std::string keep_alive;
 };
 
+// Context is split in two files under base_dir:
+// - settings.json: shared, read-mostly (model, mode, env block, keep_alive)
+// - sessions/<id>.json: the transcript of one terminal session
+// The session id comes from AI_SHELL_SESSION, or else the parent shell PID,
+// so concurrent terminals never overwrite each other's history. All writes go
+// to a temp file first and are renamed into place.
 class ContextManager {
 public:
-  ContextManager(const std::string &file_path);
+  ContextManager(const std::string &base_dir);
 
   bool load_context(AiContext &context);
+  // Always writes the session; settings only when they changed since load
   bool save_context(const AiContext &context);
   void clear_context();
   bool exists();
 
+  const std::string &session_id() const { return session; }
+
+  // Writes data to a temp file next to path and renames it into place
+  static bool write_atomic(const std::string &path, const std::string &data);
+
 private:
-  std::string file_path;
+  std::string base_dir;
+  std::string settings_path;
+  std::string session_path;
+  std::string session;
+  // Settings as last read/written, to skip rewriting the shared file
+  std::string loaded_settings;
+
+  static std::string detect_session_id();
+  std::string serialize_settings(const AiContext &context) const;
+  bool migrate_legacy_context();
+  void prune_stale_sessions();
 };
 
 #endif // CONTEXT_MANAGER_H
@@ -1,167 +1,130 @@
 #include "http_client.h"
-#include <iostream>
+#include "tcp_socket.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <vector>
-#include <windows.h>
-#include <winhttp.h>
 
-namespace http {
-
-Client::Client(const std::string &host, int port) : host(host), port(port) {}
-
-Client::~Client() {}
+// Backend-independent part of http::Client. The transport lives in
+// http_client_winhttp.cpp or http_client_socket.cpp.
 
-Response Client::post(const std::string &path, const std::string &json_body) {
-  Response response = {0, ""};
-
-  HINTERNET hSession =
-      WinHttpOpen(L"AI-Shell-Agent/1.0", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
-                  WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
-  if (!hSession)
-    return response;
+namespace http {
 
-  // Set timeout to 5 minutes (300000 ms) for LLM responses
-  WinHttpSetTimeouts(hSession, 300000, 300000, 300000, 300000);
+namespace {
 
-  std::wstring wHost(host.begin(), host.end());
-  HINTERNET hConnect = WinHttpConnect(hSession, wHost.c_str(), port, 0);
-  if (!hConnect) {
-    WinHttpCloseHandle(hSession);
-    return response;
+// Worker threads behind the async API. Requests mostly wait on the network,
+// so two threads are enough to overlap the readiness probe, model listing,
+// warm-up and generation. Started on first use.
+class IoThreads {
+public:
+  static IoThreads &instance() {
+    static IoThreads threads;
+    return threads;
   }
 
-  std::wstring wPath(path.begin(), path.end());
-  HINTERNET hRequest =
-      WinHttpOpenRequest(hConnect, L"POST", wPath.c_str(), NULL,
-                         WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, 0);
-  if (!hRequest) {
-    WinHttpCloseHandle(hConnect);
-    WinHttpCloseHandle(hSession);
-    return response;
+  // Workers are detached at exit rather than joined: a pending warm-up must
+  // not keep the process alive. They share the queue state, so it outlives
+  // this object.
+  ~IoThreads() {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->stopping = true;
+    state->queue.clear();
+    state->cv.notify_all();
   }
 
-  std::wstring headers = L"Content-Type: application/json\r\n";
-  BOOL bResults =
-      WinHttpSendRequest(hRequest, headers.c_str(), (DWORD)headers.length(),
-                         (LPVOID)json_body.c_str(), (DWORD)json_body.length(),
-                         (DWORD)json_body.length(), 0);
-
-  if (bResults) {
-    bResults = WinHttpReceiveResponse(hRequest, NULL);
+  void post(std::function<void()> task) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->queue.push_back(std::move(task));
+    if (!started) {
+      started = true;
+      for (int i = 0; i < WORKERS; ++i)
+        std::thread(run, state).detach();
+    }
+    state->cv.notify_one();
   }
 
-  if (bResults) {
-    DWORD dwStatusCode = 0;
-    DWORD dwSize = sizeof(dwStatusCode);
-    WinHttpQueryHeaders(hRequest,
-                        WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
-                        WINHTTP_HEADER_NAME_BY_INDEX, &dwStatusCode, &dwSize,
-                        WINHTTP_NO_HEADER_INDEX);
-    response.status_code = dwStatusCode;
-
-    DWORD dwSizeAvailable = 0;
-    std::vector<char> buffer;
-    do {
-      dwSizeAvailable = 0;
-      if (!WinHttpQueryDataAvailable(hRequest, &dwSizeAvailable))
-        break;
-      if (dwSizeAvailable == 0)
-        break;
-
-      std::vector<char> chunk(dwSizeAvailable + 1);
-      DWORD dwDownloaded = 0;
-      if (WinHttpReadData(hRequest, &chunk[0], dwSizeAvailable,
-                          &dwDownloaded)) {
-        buffer.insert(buffer.end(), chunk.begin(),
-                      chunk.begin() + dwDownloaded);
+private:
+  static const int WORKERS = 2;
+
+  struct State {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> queue;
+    bool stopping = false;
+  };
+  std::shared_ptr<State> state = std::make_shared<State>();
+  bool started = false;
+
+  static void run(std::shared_ptr<State> state) {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->cv.wait(lock,
+                       [&] { return state->stopping || !state->queue.empty(); });
+        if (state->stopping)
+          return;
+        task = std::move(state->queue.front());
+        state->queue.pop_front();
       }
-    } while (dwSizeAvailable > 0);
-
-    if (!buffer.empty()) {
-      response.body.assign(buffer.begin(), buffer.end());
+      task();
     }
-  } else {
-    // std::cerr << "WinHTTP Error: " << GetLastError() << std::endl;
   }
+};
 
-  WinHttpCloseHandle(hRequest);
-  WinHttpCloseHandle(hConnect);
-  WinHttpCloseHandle(hSession);
-
-  return response;
+std::future<Response> run_async(std::function<Response()> request) {
+  auto task = std::make_shared<std::packaged_task<Response()>>(std::move(request));
+  std::future<Response> result = task->get_future();
+  IoThreads::instance().post([task] { (*task)(); });
+  return result;
 }
 
-Response Client::get(const std::string &path) {
-  Response response = {0, ""};
-
-  HINTERNET hSession =
-      WinHttpOpen(L"AI-Shell-Agent/1.0", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
-                  WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
-  if (!hSession)
-    return response;
-
-  std::wstring wHost(host.begin(), host.end());
-  HINTERNET hConnect = WinHttpConnect(hSession, wHost.c_str(), port, 0);
-  if (!hConnect) {
-    WinHttpCloseHandle(hSession);
-    return response;
-  }
-
-  std::wstring wPath(path.begin(), path.end());
-  HINTERNET hRequest =
-      WinHttpOpenRequest(hConnect, L"GET", wPath.c_str(), NULL,
-                         WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, 0);
-  if (!hRequest) {
-    WinHttpCloseHandle(hConnect);
-    WinHttpCloseHandle(hSession);
-    return response;
-  }
-
-  BOOL bResults = WinHttpSendRequest(hRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0,
-                                     WINHTTP_NO_REQUEST_DATA, 0, 0, 0);
+} // namespace
 
-  if (bResults) {
-    bResults = WinHttpReceiveResponse(hRequest, NULL);
-  }
+Response Client::post(const std::string &path, const std::string &json_body,
+                      const RequestOptions &options) {
+  return send("POST", path, &json_body, nullptr, options);
+}
 
-  if (bResults) {
-    DWORD dwStatusCode = 0;
-    DWORD dwSize = sizeof(dwStatusCode);
-    WinHttpQueryHeaders(hRequest,
-                        WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
-                        WINHTTP_HEADER_NAME_BY_INDEX, &dwStatusCode, &dwSize,
-                        WINHTTP_NO_HEADER_INDEX);
-    response.status_code = dwStatusCode;
-
-    DWORD dwSizeAvailable = 0;
-    std::vector<char> buffer;
-    do {
-      dwSizeAvailable = 0;
-      if (!WinHttpQueryDataAvailable(hRequest, &dwSizeAvailable))
-        break;
-      if (dwSizeAvailable == 0)
-        break;
-
-      std::vector<char> chunk(dwSizeAvailable + 1);
-      DWORD dwDownloaded = 0;
-      if (WinHttpReadData(hRequest, &chunk[0], dwSizeAvailable,
-                          &dwDownloaded)) {
-        buffer.insert(buffer.end(), chunk.begin(),
-                      chunk.begin() + dwDownloaded);
-      }
-    } while (dwSizeAvailable > 0);
+Response Client::post_stream(const std::string &path,
+                             const std::string &json_body,
+                             const ChunkCallback &on_chunk,
+                             const RequestOptions &options) {
+  return send("POST", path, &json_body, &on_chunk, options);
+}
 
-    if (!buffer.empty()) {
-      response.body.assign(buffer.begin(), buffer.end());
-    }
-  }
+Response Client::get(const std::string &path, const RequestOptions &options) {
+  return send("GET", path, nullptr, nullptr, options);
+}
 
-  WinHttpCloseHandle(hRequest);
-  WinHttpCloseHandle(hConnect);
-  WinHttpCloseHandle(hSession);
+std::future<Response> Client::post_async(const std::string &path,
+                                         const std::string &json_body,
+                                         const RequestOptions &options) {
+  std::string host = this->host;
+  int port = this->port;
+  return run_async([host, port, path, json_body, options] {
+    Client client(host, port);
+    return client.post(path, json_body, options);
+  });
+}
 
-  return response;
+std::future<Response> Client::get_async(const std::string &path,
+                                        const RequestOptions &options) {
+  std::string host = this->host;
+  int port = this->port;
+  return run_async([host, port, path, options] {
+    Client client(host, port);
+    return client.get(path, options);
+  });
 }
 
-bool Client::is_reachable() { return true; }
+bool Client::is_reachable(int timeout_ms) {
+  net::socket_t s = net::connect_tcp(host, port, timeout_ms);
+  if (s == net::INVALID_SOCKET_VALUE)
+    return false;
+  net::close_socket(s);
+  return true;
+}
 
 } // namespace http
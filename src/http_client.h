@@ -1,27 +1,97 @@
 #ifndef HTTP_CLIENT_H
 #define HTTP_CLIENT_H
 
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
 #include <string>
 
+// Backend selection: WinHTTP on Windows unless AI_SHELL_HTTP_SOCKETS is
+// defined (-DAI_SHELL_HTTP_SOCKETS), the socket backend everywhere else.
+#if defined(_WIN32) && !defined(AI_SHELL_HTTP_SOCKETS)
+#define AI_SHELL_HTTP_WINHTTP 1
+#endif
+
 namespace http {
 
+// Why a request produced no complete response
+enum class Failure { none, connect, timeout, cancelled, transport };
+
 struct Response {
   int status_code;
   std::string body;
+  Failure failure = Failure::none;
+};
+
+// Stops in-flight requests that were given this token. cancel() only stores
+// an atomic flag, so it may be called from another thread or from a signal
+// / console control handler.
+class CancelToken {
+public:
+  void cancel() { flag.store(true); }
+  void reset() { flag.store(false); }
+  bool cancelled() const { return flag.load(); }
+
+private:
+  std::atomic<bool> flag{false};
 };
 
+// Per-request limits. Timeouts are in milliseconds; 0 means no limit.
+struct RequestOptions {
+  int connect_timeout_ms = 10000;
+  // Until the response headers arrive (covers a cold model load)
+  int first_byte_timeout_ms = 300000;
+  // Whole request, including reading the body
+  int total_timeout_ms = 0;
+  const CancelToken *cancel = nullptr;
+};
+
+// Receives body bytes as they arrive. Return false to stop reading; the
+// connection is then dropped.
+using ChunkCallback = std::function<bool(const char *data, size_t len)>;
+
 class Client {
 public:
   Client(const std::string &host, int port);
   ~Client();
 
-  Response post(const std::string &path, const std::string &json_body);
-  Response get(const std::string &path);
-  bool is_reachable();
+  Response post(const std::string &path, const std::string &json_body,
+                const RequestOptions &options = RequestOptions());
+  // Like post, but a 200 body is handed to on_chunk instead of being
+  // collected in Response::body. Error bodies are still collected.
+  Response post_stream(const std::string &path, const std::string &json_body,
+                       const ChunkCallback &on_chunk,
+                       const RequestOptions &options = RequestOptions());
+  Response get(const std::string &path,
+               const RequestOptions &options = RequestOptions());
+
+  // Like post/get, but run on the shared HTTP I/O threads so the caller can
+  // do other work meanwhile. Each request uses its own Client, so the future
+  // may outlive this one; a cancel token in options must stay alive until
+  // the request completes.
+  std::future<Response>
+  post_async(const std::string &path, const std::string &json_body,
+             const RequestOptions &options = RequestOptions());
+  std::future<Response>
+  get_async(const std::string &path,
+            const RequestOptions &options = RequestOptions());
+  // true if something accepts TCP connections on host:port within
+  // timeout_ms. No HTTP is spoken, so this is cheap enough to poll.
+  bool is_reachable(int timeout_ms = 250);
 
 private:
   std::string host;
   int port;
+
+  // Backend state (http_client_winhttp.cpp / http_client_socket.cpp)
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+
+  Response send(const char *method, const std::string &path,
+                const std::string *body, const ChunkCallback *on_chunk,
+                const RequestOptions &options);
 };
 
 } // namespace http
@@ -0,0 +1,407 @@
+#include "http_client.h"
+
+#ifndef AI_SHELL_HTTP_WINHTTP
+
+#include "tcp_socket.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// HTTP/1.1 over plain sockets: persistent keep-alive connections shared
+// process-wide, chunked transfer decoding, bounded connect and I/O waits.
+
+namespace http {
+
+namespace {
+
+// Same budget the WinHTTP backend uses: LLM responses can take minutes
+const int IO_TIMEOUT_MS = 300000;
+// Idle keep-alive connections kept per host:port
+const size_t MAX_IDLE_PER_HOST = 4;
+// Bytes requested from the socket per read
+const size_t RECV_CHUNK = 16384;
+// How often a blocked read checks the cancel token
+const int CANCEL_POLL_MS = 50;
+
+using steady = std::chrono::steady_clock;
+
+// Turns RequestOptions into bounds for the individual socket waits and
+// records why a request ran out of time.
+class RequestClock {
+public:
+  explicit RequestClock(const RequestOptions &options)
+      : options(options), first_byte_deadline(after(options.first_byte_timeout_ms)),
+        total_deadline(after(options.total_timeout_ms)) {}
+
+  Failure failure = Failure::none;
+  const RequestOptions &options;
+  const steady::time_point first_byte_deadline;
+
+  // Time point ms from now; no limit for ms <= 0
+  static steady::time_point after(int ms) {
+    if (ms <= 0)
+      return steady::time_point::max();
+    return steady::now() + std::chrono::milliseconds(ms);
+  }
+
+  // Timeout for one wait that may last until `until`, shortened by the total
+  // deadline and sliced while a cancel token has to be polled. Returns false
+  // once the request is cancelled or out of time.
+  bool wait_budget(steady::time_point until, int &wait_ms) {
+    if (options.cancel && options.cancel->cancelled()) {
+      failure = Failure::cancelled;
+      return false;
+    }
+    wait_ms = remaining_ms(until);
+    if (wait_ms == 0)
+      return false;
+    if (options.cancel && (wait_ms < 0 || wait_ms > CANCEL_POLL_MS))
+      wait_ms = CANCEL_POLL_MS;
+    return true;
+  }
+
+  // Unsliced time left until `until` or the total deadline: -1 for no
+  // limit, 0 (recorded as a timeout) once it has passed
+  int remaining_ms(steady::time_point until) {
+    steady::time_point end = std::min(until, total_deadline);
+    if (end == steady::time_point::max())
+      return -1;
+    long long left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         end - steady::now())
+                         .count();
+    if (left <= 0) {
+      failure = Failure::timeout;
+      return 0;
+    }
+    return (int)std::min<long long>(left, INT_MAX);
+  }
+
+private:
+  const steady::time_point total_deadline;
+};
+
+// Idle keep-alive connections, shared by every Client in the process so the
+// readiness probe, the chat request and the auto-fix request reuse one TCP
+// connection.
+class ConnectionPool {
+public:
+  // Never destroyed: async requests (the warm-up) can still be using it
+  // on a detached worker while static destructors run at exit. The
+  // system closes the sockets.
+  static ConnectionPool &instance() {
+    static ConnectionPool *pool = new ConnectionPool;
+    return *pool;
+  }
+
+  // Returns a live idle connection, or INVALID_SOCKET_VALUE
+  net::socket_t acquire(const std::string &key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (true) {
+      auto it = std::find_if(idle.rbegin(), idle.rend(),
+                             [&](const auto &e) { return e.first == key; });
+      if (it == idle.rend())
+        return net::INVALID_SOCKET_VALUE;
+      net::socket_t s = it->second;
+      idle.erase(std::next(it).base());
+      if (!net::is_stale(s))
+        return s;
+      net::close_socket(s);
+    }
+  }
+
+  void release(const std::string &key, net::socket_t s) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t count = std::count_if(idle.begin(), idle.end(),
+                                 [&](const auto &e) { return e.first == key; });
+    if (count >= MAX_IDLE_PER_HOST) {
+      net::close_socket(s);
+      return;
+    }
+    idle.emplace_back(key, s);
+  }
+
+private:
+  std::mutex mutex;
+  std::vector<std::pair<std::string, net::socket_t>> idle;
+};
+
+enum class ReadStatus { ok, aborted, failed };
+
+using Sink = std::function<bool(const char *, size_t)>;
+
+// Buffered reader over one response on a connection
+class ResponseReader {
+public:
+  ResponseReader(net::socket_t s, RequestClock &clock) : s(s), clock(clock) {}
+
+  bool received_any() const { return total_received > 0; }
+
+  // Reads one line, without the trailing CRLF
+  bool read_line(std::string &line) {
+    while (true) {
+      size_t eol = buf.find('\n', pos);
+      if (eol != std::string::npos) {
+        size_t end = (eol > pos && buf[eol - 1] == '\r') ? eol - 1 : eol;
+        line.assign(buf, pos, end - pos);
+        pos = eol + 1;
+        return true;
+      }
+      if (!fill())
+        return false;
+    }
+  }
+
+  // Hands exactly n body bytes to sink, as they arrive
+  ReadStatus read_exact(size_t n, const Sink &sink) {
+    while (n > 0) {
+      if (pos == buf.size() && !fill())
+        return ReadStatus::failed;
+      size_t take = std::min(n, buf.size() - pos);
+      if (!sink(buf.data() + pos, take))
+        return ReadStatus::aborted;
+      pos += take;
+      n -= take;
+    }
+    return ReadStatus::ok;
+  }
+
+  // Bodies without length or chunking end when the server closes
+  ReadStatus read_to_eof(const Sink &sink) {
+    while (true) {
+      if (pos < buf.size()) {
+        if (!sink(buf.data() + pos, buf.size() - pos))
+          return ReadStatus::aborted;
+        pos = buf.size();
+      }
+      if (!fill())
+        return last_recv == net::RECV_CLOSED ? ReadStatus::ok
+                                             : ReadStatus::failed;
+    }
+  }
+
+private:
+  net::socket_t s;
+  RequestClock &clock;
+  std::string buf;
+  size_t pos = 0;
+  size_t total_received = 0;
+  long last_recv = 0;
+
+  bool fill() {
+    if (pos == buf.size()) {
+      buf.clear();
+      pos = 0;
+    } else if (pos > 0 && pos >= buf.size() / 2) {
+      buf.erase(0, pos);
+      pos = 0;
+    }
+    // The first-byte limit applies until the response starts, then each
+    // read is bounded by the I/O timeout. Receive straight into the buffer
+    // tail rather than via a stack copy.
+    steady::time_point until = total_received == 0
+                                   ? clock.first_byte_deadline
+                                   : RequestClock::after(IO_TIMEOUT_MS);
+    size_t used = buf.size();
+    buf.resize(used + RECV_CHUNK);
+    int wait_ms = 0;
+    do {
+      if (!clock.wait_budget(until, wait_ms)) {
+        last_recv = net::RECV_TIMEOUT;
+        break;
+      }
+      last_recv = net::recv_some(s, &buf[used], RECV_CHUNK, wait_ms);
+    } while (last_recv == net::RECV_TIMEOUT);
+    buf.resize(used + (last_recv > 0 ? (size_t)last_recv : 0));
+    if (last_recv <= 0)
+      return false;
+    total_received += (size_t)last_recv;
+    return true;
+  }
+};
+
+std::string to_lower(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(),
+                 [](unsigned char c) { return (char)std::tolower(c); });
+  return s;
+}
+
+std::string trim(const std::string &s) {
+  const char *ws = " \t";
+  size_t first = s.find_first_not_of(ws);
+  if (first == std::string::npos)
+    return "";
+  return s.substr(first, s.find_last_not_of(ws) - first + 1);
+}
+
+} // namespace
+
+struct Client::Impl {
+  std::string pool_key;
+};
+
+Client::Client(const std::string &host, int port)
+    : host(host), port(port), impl(new Impl()) {
+  impl->pool_key = host + ":" + std::to_string(port);
+}
+
+Client::~Client() {}
+
+Response Client::send(const char *method, const std::string &path,
+                      const std::string *body, const ChunkCallback *on_chunk,
+                      const RequestOptions &options) {
+  Response response = {0, ""};
+  RequestClock clock(options);
+  // Marks the response as failed, with the clock's reason when it has one
+  auto fail = [&](Failure fallback) {
+    response.status_code = 0;
+    response.failure =
+        clock.failure != Failure::none ? clock.failure : fallback;
+    return response;
+  };
+
+  std::string head = std::string(method) + " " + path + " HTTP/1.1\r\n";
+  head += "Host: " + impl->pool_key + "\r\n";
+  head += "User-Agent: AI-Shell-Agent/1.0\r\n";
+  head += "Accept: */*\r\n";
+  head += "Connection: keep-alive\r\n";
+  if (body) {
+    head += "Content-Type: application/json\r\n";
+    head += "Content-Length: " + std::to_string(body->size()) + "\r\n";
+  }
+  head += "\r\n";
+
+  // A pooled connection may have been closed by the server while idle; if
+  // it fails before any response byte arrives, retry once on a fresh one.
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    if (options.cancel && options.cancel->cancelled())
+      return fail(Failure::cancelled);
+    net::socket_t s = ConnectionPool::instance().acquire(impl->pool_key);
+    bool reused = s != net::INVALID_SOCKET_VALUE;
+    if (!reused) {
+      // Connects are not sliced for the cancel token; a local server
+      // accepts or refuses right away
+      int connect_ms =
+          clock.remaining_ms(RequestClock::after(options.connect_timeout_ms));
+      if (connect_ms == 0)
+        return fail(Failure::timeout);
+      s = net::connect_tcp(host, port, connect_ms < 0 ? INT_MAX : connect_ms);
+    }
+    if (s == net::INVALID_SOCKET_VALUE)
+      return fail(Failure::connect);
+
+    int send_ms = clock.remaining_ms(RequestClock::after(IO_TIMEOUT_MS));
+    bool sent = send_ms != 0 &&
+                net::send_all(s, head.data(), head.size(), send_ms) &&
+                (!body || net::send_all(s, body->data(), body->size(), send_ms));
+    ResponseReader reader(s, clock);
+    std::string line;
+    if (!sent || !reader.read_line(line)) {
+      net::close_socket(s);
+      if (reused && !reader.received_any() && clock.failure == Failure::none)
+        continue;
+      return fail(Failure::transport);
+    }
+
+    // Status line, skipping interim 1xx responses
+    bool keep_alive = true;
+    long content_length = -1;
+    bool chunked = false;
+    bool headers_ok = true;
+    while (true) {
+      size_t sp = line.find(' ');
+      response.status_code =
+          sp == std::string::npos ? 0 : std::atoi(line.c_str() + sp + 1);
+      if (line.compare(0, 8, "HTTP/1.0") == 0)
+        keep_alive = false;
+
+      while ((headers_ok = reader.read_line(line)) && !line.empty()) {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+          continue;
+        std::string name = to_lower(trim(line.substr(0, colon)));
+        std::string value = trim(line.substr(colon + 1));
+        if (name == "content-length")
+          content_length = std::atol(value.c_str());
+        else if (name == "transfer-encoding")
+          chunked = to_lower(value).find("chunked") != std::string::npos;
+        else if (name == "connection")
+          keep_alive = to_lower(value).find("close") == std::string::npos;
+      }
+      if (!headers_ok || response.status_code >= 200 ||
+          response.status_code < 100)
+        break;
+      if (!reader.read_line(line)) {
+        headers_ok = false;
+        break;
+      }
+    }
+    if (!headers_ok || response.status_code == 0) {
+      net::close_socket(s);
+      return fail(Failure::transport);
+    }
+
+    // Only successful bodies are streamed; errors are collected for the caller
+    bool streaming = on_chunk && *on_chunk && response.status_code == 200;
+    Sink sink = [&](const char *data, size_t len) {
+      if (streaming)
+        return (*on_chunk)(data, len);
+      response.body.append(data, len);
+      return true;
+    };
+
+    ReadStatus status = ReadStatus::ok;
+    bool no_body = std::string(method) == "HEAD" ||
+                   response.status_code == 204 || response.status_code == 304;
+    if (no_body) {
+      // nothing to read
+    } else if (chunked) {
+      while (status == ReadStatus::ok) {
+        if (!reader.read_line(line)) {
+          status = ReadStatus::failed;
+          break;
+        }
+        size_t size = std::strtoul(line.c_str(), nullptr, 16);
+        if (size == 0) {
+          // Trailer section ends with an empty line
+          while ((status = reader.read_line(line) ? ReadStatus::ok
+                                                  : ReadStatus::failed) ==
+                     ReadStatus::ok &&
+                 !line.empty()) {
+          }
+          break;
+        }
+        status = reader.read_exact(size, sink);
+        if (status == ReadStatus::ok && !reader.read_line(line))
+          status = ReadStatus::failed;
+      }
+    } else if (content_length >= 0) {
+      if (!streaming)
+        response.body.reserve((size_t)content_length);
+      status = reader.read_exact((size_t)content_length, sink);
+    } else {
+      status = reader.read_to_eof(sink);
+      keep_alive = false;
+    }
+
+    if (status == ReadStatus::ok && keep_alive)
+      ConnectionPool::instance().release(impl->pool_key, s);
+    else
+      net::close_socket(s); // aborted streams end the generation server-side
+    // A body cut short by a deadline or cancel keeps its status code, but
+    // the caller learns that it is incomplete
+    if (status == ReadStatus::failed)
+      response.failure =
+          clock.failure != Failure::none ? clock.failure : Failure::transport;
+    return response;
+  }
+  return response;
+}
+
+} // namespace http
+
+#endif // !AI_SHELL_HTTP_WINHTTP
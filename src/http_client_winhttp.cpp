@@ -0,0 +1,322 @@
+#include "http_client.h"
+
+#ifdef AI_SHELL_HTTP_WINHTTP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <windows.h>
+#include <winhttp.h>
+
+namespace http {
+
+namespace {
+
+using ConnectionHandle = std::shared_ptr<void>;
+
+// One WinHTTP session for the whole process plus one connection handle per
+// host:port. WinHTTP keeps the underlying TCP connections alive inside the
+// session, so reusing these handles removes the per-request session and
+// connection setup. Handles are reference counted: a connection dropped
+// after a failure stays valid for requests still using it.
+class SessionPool {
+public:
+  // Never destroyed: async requests (the warm-up) can still be using it
+  // on a detached worker while static destructors run at exit. The
+  // handles go away with the process.
+  static SessionPool &instance() {
+    static SessionPool *pool = new SessionPool;
+    return *pool;
+  }
+
+  ConnectionHandle connect(const std::wstring &host, int port) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::wstring key = host + L":" + std::to_wstring(port);
+    auto it = connections.find(key);
+    if (it != connections.end())
+      return it->second;
+
+    if (!session) {
+      session =
+          WinHttpOpen(L"AI-Shell-Agent/1.0", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+                      WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+      if (!session)
+        return nullptr;
+    }
+    HINTERNET hConnect =
+        WinHttpConnect(session, host.c_str(), (INTERNET_PORT)port, 0);
+    if (!hConnect)
+      return nullptr;
+    ConnectionHandle handle(hConnect, WinHttpCloseHandle);
+    connections[key] = handle;
+    return handle;
+  }
+
+  // Forget a connection that failed; the next request reconnects
+  void invalidate(const ConnectionHandle &handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = connections.begin(); it != connections.end(); ++it) {
+      if (it->second == handle) {
+        connections.erase(it);
+        return;
+      }
+    }
+  }
+
+private:
+  std::mutex mutex;
+  HINTERNET session = nullptr;
+  std::map<std::wstring, ConnectionHandle> connections;
+};
+
+// Failures that mean the pooled connection went bad rather than the server
+// being down or slow; worth one retry on a fresh connection handle
+bool is_stale_connection_error(DWORD err) {
+  return err == ERROR_WINHTTP_CONNECTION_ERROR ||
+         err == ERROR_WINHTTP_INVALID_SERVER_RESPONSE ||
+         err == ERROR_WINHTTP_RESEND_REQUEST || err == ERROR_INVALID_HANDLE;
+}
+
+// Same budget the socket backend uses for reads once the body is flowing
+const DWORD IO_TIMEOUT_MS = 300000;
+
+// Synchronous WinHTTP calls can only be aborted by closing the request
+// handle from another thread. When a request has a cancel token or a total
+// deadline, a helper thread does that; otherwise the handle is just closed
+// at the end.
+class RequestWatchdog {
+public:
+  RequestWatchdog(HINTERNET request, const RequestOptions &options,
+                  std::chrono::steady_clock::time_point deadline)
+      : request(request) {
+    if (options.cancel || options.total_timeout_ms > 0)
+      thread = std::thread([this, &options, deadline] {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!done) {
+          if (options.cancel && options.cancel->cancelled())
+            reason = Failure::cancelled;
+          else if (std::chrono::steady_clock::now() >= deadline)
+            reason = Failure::timeout;
+          if (reason != Failure::none) {
+            close_locked();
+            return;
+          }
+          cv.wait_for(lock, std::chrono::milliseconds(50));
+        }
+      });
+  }
+
+  ~RequestWatchdog() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+      close_locked();
+    }
+    cv.notify_one();
+    if (thread.joinable())
+      thread.join();
+  }
+
+  // Set once the watchdog aborted the request
+  Failure failure() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return reason;
+  }
+
+private:
+  HINTERNET request;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool done = false;
+  Failure reason = Failure::none;
+  std::thread thread;
+
+  void close_locked() {
+    if (request)
+      WinHttpCloseHandle(request);
+    request = NULL;
+  }
+};
+
+Failure failure_from_error(DWORD err) {
+  if (err == ERROR_WINHTTP_TIMEOUT)
+    return Failure::timeout;
+  if (err == ERROR_WINHTTP_CANNOT_CONNECT)
+    return Failure::connect;
+  return Failure::transport;
+}
+
+} // namespace
+
+struct Client::Impl {
+  std::wstring host;
+  ConnectionHandle connection;
+};
+
+Client::Client(const std::string &host, int port)
+    : host(host), port(port), impl(new Impl()) {
+  impl->host.assign(host.begin(), host.end());
+}
+
+Client::~Client() {}
+
+Response Client::send(const char *method, const std::string &path,
+                      const std::string *body, const ChunkCallback *on_chunk,
+                      const RequestOptions &options) {
+  Response response = {0, ""};
+
+  std::string method_str(method);
+  std::wstring wMethod(method_str.begin(), method_str.end());
+  std::wstring wPath(path.begin(), path.end());
+
+  auto deadline = std::chrono::steady_clock::time_point::max();
+  if (options.total_timeout_ms > 0)
+    deadline = std::chrono::steady_clock::now() +
+               std::chrono::milliseconds(options.total_timeout_ms);
+
+  HINTERNET hRequest = NULL;
+  // Owns hRequest from here on; destroying it closes the request
+  std::unique_ptr<RequestWatchdog> watchdog;
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    if (options.cancel && options.cancel->cancelled()) {
+      response.failure = Failure::cancelled;
+      return response;
+    }
+    if (!impl->connection)
+      impl->connection = SessionPool::instance().connect(impl->host, port);
+    if (!impl->connection) {
+      response.failure = Failure::connect;
+      return response;
+    }
+
+    hRequest = WinHttpOpenRequest(
+        (HINTERNET)impl->connection.get(), wMethod.c_str(), wPath.c_str(),
+        NULL, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, 0);
+    if (!hRequest) {
+      SessionPool::instance().invalidate(impl->connection);
+      impl->connection.reset();
+      continue;
+    }
+    watchdog.reset(new RequestWatchdog(hRequest, options, deadline));
+
+    // WinHTTP also treats 0 as "no limit". The receive timeout covers the
+    // wait for the response headers, i.e. the first byte.
+    WinHttpSetTimeouts(hRequest, 0, options.connect_timeout_ms, IO_TIMEOUT_MS,
+                       options.first_byte_timeout_ms);
+
+    BOOL bResults;
+    if (body) {
+      std::wstring headers = L"Content-Type: application/json\r\n";
+      bResults =
+          WinHttpSendRequest(hRequest, headers.c_str(), (DWORD)headers.length(),
+                             (LPVOID)body->c_str(), (DWORD)body->length(),
+                             (DWORD)body->length(), 0);
+    } else {
+      bResults = WinHttpSendRequest(hRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0,
+                                    WINHTTP_NO_REQUEST_DATA, 0, 0, 0);
+    }
+
+    if (bResults) {
+      bResults = WinHttpReceiveResponse(hRequest, NULL);
+    }
+    if (bResults)
+      break;
+
+    DWORD err = GetLastError();
+    Failure aborted = watchdog->failure();
+    watchdog.reset();
+    hRequest = NULL;
+    if (aborted != Failure::none || !is_stale_connection_error(err)) {
+      response.failure = aborted != Failure::none ? aborted
+                                                  : failure_from_error(err);
+      return response;
+    }
+    SessionPool::instance().invalidate(impl->connection);
+    impl->connection.reset();
+  }
+  if (!hRequest) {
+    response.failure = Failure::transport;
+    return response;
+  }
+
+  DWORD dwStatusCode = 0;
+  DWORD dwSize = sizeof(dwStatusCode);
+  WinHttpQueryHeaders(hRequest,
+                      WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+                      WINHTTP_HEADER_NAME_BY_INDEX, &dwStatusCode, &dwSize,
+                      WINHTTP_NO_HEADER_INDEX);
+  response.status_code = dwStatusCode;
+
+  // Once the body flows, each read gets the regular I/O timeout
+  DWORD dwReceiveTimeout = IO_TIMEOUT_MS;
+  WinHttpSetOption(hRequest, WINHTTP_OPTION_RECEIVE_TIMEOUT, &dwReceiveTimeout,
+                   sizeof(dwReceiveTimeout));
+
+  // Only successful bodies are streamed; errors are collected for the caller
+  bool streaming = on_chunk && *on_chunk && dwStatusCode == 200;
+
+  // Bodies are read straight into their final buffer: response.body when
+  // collecting (sized from Content-Length when the server sends one), or
+  // one reused scratch buffer when streaming.
+  std::string scratch;
+  std::string &target = streaming ? scratch : response.body;
+  DWORD dwContentLength = 0;
+  dwSize = sizeof(dwContentLength);
+  if (!streaming &&
+      WinHttpQueryHeaders(hRequest,
+                          WINHTTP_QUERY_CONTENT_LENGTH |
+                              WINHTTP_QUERY_FLAG_NUMBER,
+                          WINHTTP_HEADER_NAME_BY_INDEX, &dwContentLength,
+                          &dwSize, WINHTTP_NO_HEADER_INDEX)) {
+    target.reserve(dwContentLength);
+  }
+
+  DWORD dwSizeAvailable = 0;
+  do {
+    dwSizeAvailable = 0;
+    if (!WinHttpQueryDataAvailable(hRequest, &dwSizeAvailable)) {
+      // A body cut short keeps its status code, but the caller learns that
+      // it is incomplete
+      Failure aborted = watchdog->failure();
+      response.failure = aborted != Failure::none
+                             ? aborted
+                             : failure_from_error(GetLastError());
+      break;
+    }
+    if (dwSizeAvailable == 0)
+      break;
+
+    size_t used = streaming ? 0 : target.size();
+    if (target.capacity() < used + dwSizeAvailable)
+      target.reserve(std::max(used + dwSizeAvailable, target.capacity() * 2));
+    target.resize(used + dwSizeAvailable);
+    DWORD dwDownloaded = 0;
+    if (!WinHttpReadData(hRequest, &target[used], dwSizeAvailable,
+                         &dwDownloaded)) {
+      target.resize(used);
+      Failure aborted = watchdog->failure();
+      response.failure = aborted != Failure::none
+                             ? aborted
+                             : failure_from_error(GetLastError());
+      break;
+    }
+    target.resize(used + dwDownloaded);
+    if (streaming && !(*on_chunk)(target.data(), dwDownloaded))
+      break;
+  } while (dwSizeAvailable > 0);
+
+  // Closing only the request (via the watchdog) leaves the connection open
+  // for the next one
+  watchdog.reset();
+
+  return response;
+}
+
+} // namespace http
+
+#endif // AI_SHELL_HTTP_WINHTTP
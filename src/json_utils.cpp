@@ -1,4 +1,5 @@
 #include "json_utils.h"
+#include <charconv>
 #include <iostream>
 
 namespace json {
@@ -23,22 +24,160 @@ parse_simple_object(const std::string &input) {
   return result;
 }
 
-std::string extract_response_content(const std::string &json_response) {
-  try {
-    auto j = json_t::parse(json_response);
-    // Ollama /api/chat response structure
-    // { "message": { "content": "..." }, ... }
-    if (j.contains("message") && j["message"].contains("content")) {
-      return j["message"]["content"].get<std::string>();
+namespace {
+
+// SAX handler that only tracks the object path down to message.content and
+// records the handful of top-level fields ChatResponse needs.
+class ChatResponseSax {
+public:
+  explicit ChatResponseSax(ChatResponse &out) : out(out) {}
+
+  // Top-level "content" is only used when there was no message.content
+  bool has_message_content = false;
+  std::string top_level_content;
+
+  bool null() { return true; }
+  bool boolean(bool val) {
+    if (depth == 1 && current_key == "done")
+      out.done = val;
+    return true;
+  }
+  bool number_integer(json_t::number_integer_t val) {
+    return number((long long)val);
+  }
+  bool number_unsigned(json_t::number_unsigned_t val) {
+    return number((long long)val);
+  }
+  bool number_float(json_t::number_float_t val, const json_t::string_t &) {
+    return number((long long)val);
+  }
+  bool string(json_t::string_t &val) {
+    if (depth == 1 && current_key == "content") {
+      top_level_content = std::move(val);
+    } else if (depth == 1 && current_key == "error") {
+      out.error = std::move(val);
+    } else if (depth == message_depth && current_key == "content") {
+      out.content = std::move(val);
+      has_message_content = true;
+    } else if (depth == 2 && error_depth == 2 && current_key == "message") {
+      out.error = std::move(val); // OpenAI {"error": {"message": ...}}
+    } else if (depth == 3 && choices_depth == 2 &&
+               current_key == "finish_reason") {
+      out.done = true;
     }
-    // Direct content (legacy or different endpoint)
-    if (j.contains("content")) {
-      return j["content"].get<std::string>();
+    return true;
+  }
+  bool binary(json_t::binary_t &) { return true; }
+  // Ollama: {"message": {...}}. OpenAI: {"choices": [{"message": {...}}]}
+  // or {"choices": [{"delta": {...}}]} when streaming.
+  bool start_object(std::size_t) {
+    ++depth;
+    if (depth == 2 && current_key == "message")
+      message_depth = 2;
+    else if (depth == 4 && choices_depth == 2 &&
+             (current_key == "message" || current_key == "delta"))
+      message_depth = 4;
+    else if (depth == 2 && current_key == "error")
+      error_depth = 2;
+    else if (depth == 2 && current_key == "usage")
+      usage_depth = 2;
+    current_key.clear();
+    return true;
+  }
+  bool key(json_t::string_t &val) {
+    // Keys below depth 4 are never looked at; skip the copy
+    if (depth <= 4)
+      current_key.swap(val);
+    else
+      current_key.clear();
+    return true;
+  }
+  bool end_object() {
+    if (depth == message_depth)
+      message_depth = 0;
+    if (depth == error_depth)
+      error_depth = 0;
+    if (depth == usage_depth)
+      usage_depth = 0;
+    --depth;
+    current_key.clear();
+    return true;
+  }
+  bool start_array(std::size_t) {
+    ++depth;
+    if (depth == 2 && current_key == "choices")
+      choices_depth = 2;
+    current_key.clear();
+    return true;
+  }
+  bool end_array() {
+    if (depth == choices_depth)
+      choices_depth = 0;
+    --depth;
+    current_key.clear();
+    return true;
+  }
+  bool parse_error(std::size_t, const std::string &,
+                   const nlohmann::detail::exception &) {
+    return false;
+  }
+
+private:
+  ChatResponse &out;
+  int depth = 0;
+  int message_depth = 0; // depth of the "message" object while inside it
+  int choices_depth = 0; // likewise for OpenAI "choices", "error", "usage"
+  int error_depth = 0;
+  int usage_depth = 0;
+  std::string current_key;
+
+  bool number(long long val) {
+    ChatTimings &t = out.timings;
+    // OpenAI usage only carries token counts
+    if (depth == 2 && usage_depth == 2) {
+      if (current_key == "prompt_tokens")
+        t.prompt_eval_count = val;
+      else if (current_key == "completion_tokens")
+        t.eval_count = val;
+      return true;
     }
-  } catch (const std::exception &e) {
-    // std::cerr << "JSON Error: " << e.what() << "\n";
+    if (depth != 1)
+      return true;
+    if (current_key == "total_duration")
+      t.total_duration = val;
+    else if (current_key == "load_duration")
+      t.load_duration = val;
+    else if (current_key == "prompt_eval_count")
+      t.prompt_eval_count = val;
+    else if (current_key == "prompt_eval_duration")
+      t.prompt_eval_duration = val;
+    else if (current_key == "eval_count")
+      t.eval_count = val;
+    else if (current_key == "eval_duration")
+      t.eval_duration = val;
+    return true;
   }
-  return "";
+};
+
+} // namespace
+
+bool parse_chat_response(std::string_view json_response, ChatResponse &out) {
+  ChatResponseSax sax(out);
+  bool ok = json_t::sax_parse(json_response.data(),
+                              json_response.data() + json_response.size(),
+                              &sax);
+  if (!sax.has_message_content)
+    out.content = std::move(sax.top_level_content);
+  return ok;
+}
+
+std::string extract_response_content(const std::string &json_response) {
+  // Ollama /api/chat response structure
+  // { "message": { "content": "..." }, ... }
+  // or direct content (legacy or different endpoint)
+  ChatResponse response;
+  parse_chat_response(json_response, response);
+  return response.content;
 }
 
 std::vector<std::string> extract_model_names(const std::string &json_response) {
@@ -58,6 +197,66 @@ std::vector<std::string> extract_model_names(const std::string &json_response) {
   return models;
 }
 
+std::string ChatStreamParser::feed(const char *data, size_t len) {
+  std::string delta;
+  size_t start = 0;
+  for (size_t i = 0; i < len; ++i) {
+    if (data[i] != '\n')
+      continue;
+    if (pending.empty()) {
+      delta += parse_line(std::string_view(data + start, i - start));
+    } else {
+      pending.append(data + start, i - start);
+      delta += parse_line(pending);
+      pending.clear();
+    }
+    start = i + 1;
+  }
+  pending.append(data + start, len - start);
+  return delta;
+}
+
+std::string ChatStreamParser::finish() {
+  std::string delta = parse_line(pending);
+  pending.clear();
+  return delta;
+}
+
+std::string ChatStreamParser::parse_line(std::string_view line) {
+  size_t first = line.find_first_not_of(" \t\r");
+  if (first == std::string_view::npos)
+    return "";
+  // OpenAI-compatible servers stream server-sent events: "data: {json}"
+  // lines ending with "data: [DONE]"; other event fields are skipped
+  if (line[first] != '{') {
+    if (line.substr(first, 5) != "data:")
+      return "";
+    line.remove_prefix(first + 5);
+    while (!line.empty() && (line.front() == ' ' || line.front() == '\t'))
+      line.remove_prefix(1);
+    if (line.substr(0, 6) == "[DONE]") {
+      finished = true;
+      return "";
+    }
+  }
+  ChatResponse chunk;
+  // Malformed lines are skipped; the rest of the stream is still usable
+  if (!parse_chat_response(line, chunk))
+    return "";
+  if (!chunk.error.empty()) {
+    error_message = chunk.error;
+    return "";
+  }
+  if (chunk.done) {
+    finished = true;
+    final_timings = chunk.timings;
+  } else if (chunk.timings.present()) {
+    final_timings = chunk.timings; // OpenAI usage may follow the last choice
+  }
+  full_content += chunk.content;
+  return chunk.content;
+}
+
 void Builder::add(const std::string &key, const std::string &value) {
   j_obj[key] = value;
 }
@@ -78,4 +277,165 @@ std::string Builder::build() const {
   return current.dump();
 }
 
+void write_string(std::string &out, std::string_view s) {
+  static const char hex[] = "0123456789abcdef";
+  out.reserve(out.size() + s.size() + 2);
+  out += '"';
+  size_t run = 0; // start of the pending run of bytes needing no escape
+  for (size_t i = 0; i < s.size(); ++i) {
+    unsigned char c = (unsigned char)s[i];
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    out.append(s.data() + run, i - run);
+    run = i + 1;
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      out += "\\u00";
+      out += hex[c >> 4];
+      out += hex[c & 0xF];
+    }
+  }
+  out.append(s.data() + run, s.size() - run);
+  out += '"';
+}
+
+void ChatRequestWriter::set_model(std::string_view value) {
+  model = value;
+  prefix_dirty = true;
+}
+
+void ChatRequestWriter::set_stream(bool value) {
+  stream = value;
+  prefix_dirty = true;
+}
+
+void ChatRequestWriter::set_keep_alive(std::string_view value) {
+  keep_alive.clear();
+  if (!value.empty()) {
+    // A number of seconds goes out as a JSON number, written from the
+    // parsed value so that "007" or "-0" stay valid JSON; anything else
+    // (a duration such as "5m", or a number too large) as a string
+    long long seconds = 0;
+    const char *end = value.data() + value.size();
+    auto parsed = std::from_chars(value.data(), end, seconds);
+    if (parsed.ec == std::errc() && parsed.ptr == end)
+      keep_alive = std::to_string(seconds);
+    else
+      write_string(keep_alive, value);
+  }
+  prefix_dirty = true;
+}
+
+void ChatRequestWriter::set_api(ChatApi value) {
+  api = value;
+  prefix_dirty = true;
+}
+
+void ChatRequestWriter::set_generation_options(
+    int value, const std::vector<std::string> &stop) {
+  num_predict = value;
+  stop_sequences = stop;
+  prefix_dirty = true;
+}
+
+void ChatRequestWriter::set_system_prompt(std::string_view value) {
+  system_prompt = value;
+  prefix_dirty = true;
+}
+
+void ChatRequestWriter::build_prefix() {
+  prefix.clear();
+  prefix.reserve(model.size() + system_prompt.size() + 192);
+  prefix += "{\"model\":";
+  write_string(prefix, model);
+  prefix += stream ? ",\"stream\":true" : ",\"stream\":false";
+
+  // Same limits, spelled per API: Ollama nests them in "options" and has
+  // keep_alive; OpenAI has top-level max_tokens/stop and no keep_alive
+  std::string stop_json;
+  if (!stop_sequences.empty()) {
+    stop_json = "\"stop\":[";
+    for (size_t i = 0; i < stop_sequences.size(); ++i) {
+      if (i > 0)
+        stop_json += ',';
+      write_string(stop_json, stop_sequences[i]);
+    }
+    stop_json += ']';
+  }
+  if (api == ChatApi::ollama) {
+    if (!keep_alive.empty()) {
+      prefix += ",\"keep_alive\":";
+      prefix += keep_alive;
+    }
+    if (num_predict > 0) {
+      prefix += ",\"options\":{\"num_predict\":" + std::to_string(num_predict);
+      if (!stop_json.empty())
+        prefix += "," + stop_json;
+      prefix += '}';
+    }
+  } else if (num_predict > 0) {
+    prefix += ",\"max_tokens\":" + std::to_string(num_predict);
+    if (!stop_json.empty())
+      prefix += "," + stop_json;
+  }
+  prefix += ",\"messages\":[";
+  if (!system_prompt.empty()) {
+    prefix += "{\"role\":\"system\",\"content\":";
+    write_string(prefix, system_prompt);
+    prefix += '}';
+  }
+  prefix_dirty = false;
+}
+
+void ChatRequestWriter::begin() {
+  if (prefix_dirty)
+    build_prefix();
+  out.assign(prefix); // keeps out's capacity from earlier requests
+  body_prefix_size = prefix.size();
+  has_messages = !system_prompt.empty();
+  closed = false;
+}
+
+void ChatRequestWriter::add_message(std::string_view role,
+                                    std::string_view content) {
+  if (has_messages)
+    out += ',';
+  out += "{\"role\":";
+  write_string(out, role);
+  out += ",\"content\":";
+  write_string(out, content);
+  out += '}';
+  has_messages = true;
+}
+
+const std::string &ChatRequestWriter::finish() {
+  // Settings changed after begin() (e.g. another backend's model or API)
+  // only swap the prefix; the messages are kept
+  if (prefix_dirty) {
+    build_prefix();
+    out.replace(0, body_prefix_size, prefix);
+    body_prefix_size = prefix.size();
+  }
+  if (!closed) {
+    out += "]}";
+    closed = true;
+  }
+  return out;
+}
+
 } // namespace json
@@ -4,6 +4,7 @@
 #include "json.hpp" // nlohmann/json
 #include <map>
 #include <string>
+#include <string_view>
 #include <vector>
 
 
@@ -17,12 +18,72 @@ namespace json {
 std::map<std::string, std::string>
 parse_simple_object(const std::string &input);
 
+// Model-side timing and usage reported by Ollama. Durations are in
+// nanoseconds. Fields stay 0 when the server did not send them, e.g. when a
+// stream was cut short before its final object.
+struct ChatTimings {
+  long long total_duration = 0;
+  long long load_duration = 0;
+  long long prompt_eval_count = 0;
+  long long prompt_eval_duration = 0;
+  long long eval_count = 0;
+  long long eval_duration = 0;
+
+  bool present() const { return total_duration > 0 || eval_count > 0; }
+};
+
+// The parts of an /api/chat response (or one streamed line of it) we use.
+// OpenAI-compatible responses map onto the same fields: choices[0].message
+// (or .delta) content, error.message, finish_reason as done, and usage token
+// counts as timings.
+struct ChatResponse {
+  std::string content; // message.content, or top-level "content"
+  std::string error;   // server-reported "error"
+  bool done = false;
+  ChatTimings timings;
+};
+
+// Pulls the ChatResponse fields out of a response in one SAX pass, without
+// building a DOM. Returns false on malformed JSON (fields seen before the
+// error are kept).
+bool parse_chat_response(std::string_view json_response, ChatResponse &out);
+
 // Extract "content" field from a standard Ollama/OpenAI chat response
 std::string extract_response_content(const std::string &json_response);
 
 // Extract model names from Ollama tags response
 std::vector<std::string> extract_model_names(const std::string &json_response);
 
+// Incremental parser for Ollama's streaming /api/chat body (NDJSON: one JSON
+// object per line), also accepting the "data: {...}" server-sent events of
+// OpenAI-compatible /v1/chat/completions. Bytes can be fed in arbitrary
+// chunks; partial lines are kept until their newline arrives.
+class ChatStreamParser {
+public:
+  // Returns the message.content deltas completed by this chunk
+  std::string feed(const char *data, size_t len);
+  // Parses a trailing line that had no newline; call once the body ended
+  std::string finish();
+
+  // Full content received so far
+  const std::string &content() const { return full_content; }
+  // true once the final {"done": true} object was seen
+  bool done() const { return finished; }
+  // Server-side error reported inside the stream, if any
+  const std::string &error() const { return error_message; }
+  // Timings from the final object; empty if the stream was cut short
+  const ChatTimings &timings() const { return final_timings; }
+
+private:
+  std::string pending;
+  std::string full_content;
+  std::string error_message;
+  ChatTimings final_timings;
+  bool finished = false;
+
+  std::string parse_line(std::string_view line);
+};
+
 // Simple Builder Wrapper to minimize changes in main.cpp, but internally uses
 // nlohmann/json
 class Builder {
@@ -39,6 +100,67 @@ private:
   json_t j_messages = json_t::array();
 };
 
+// Request body dialects of the chat endpoints
+enum class ChatApi {
+  ollama, // POST /api/chat
+  openai  // POST /v1/chat/completions
+};
+
+// Single-pass writer for /api/chat request bodies. Everything that stays the
+// same between requests (model, stream flag, keep_alive, options and the
+// system message) is serialized once into a prefix; each request then copies
+// that prefix into a reused buffer and appends the escaped messages directly,
+// without building a DOM or copying the inputs.
+//
+//   ChatRequestWriter w;
+//   w.set_model(model); w.set_system_prompt(prompt);
+//   w.begin();
+//   w.add_message("user", request);
+//   client.post("/api/chat", w.finish());
+class ChatRequestWriter {
+public:
+  void set_model(std::string_view model);
+  void set_api(ChatApi api);
+  void set_stream(bool stream);
+  // Bare integers are sent as seconds, anything else as a duration string.
+  // Empty leaves the server default in place.
+  void set_keep_alive(std::string_view value);
+  // Cap on generated tokens and stop sequences (Ollama "options", OpenAI
+  // max_tokens/stop)
+  void set_generation_options(int num_predict,
+                              const std::vector<std::string> &stop);
+  void set_system_prompt(std::string_view system_prompt);
+
+  // Starts a new request body (the previous one is discarded)
+  void begin();
+  void add_message(std::string_view role, std::string_view content);
+  // Closes the body; the reference stays valid until the next begin().
+  // Calling it again after changing the model or API rewrites only the
+  // prefix, so one set of messages can be sent to several backends.
+  const std::string &finish();
+
+private:
+  std::string model;
+  ChatApi api = ChatApi::ollama;
+  std::string keep_alive;
+  int num_predict = 0;
+  std::vector<std::string> stop_sequences;
+  std::string system_prompt;
+  bool stream = false;
+
+  std::string prefix;
+  bool prefix_dirty = true;
+  std::string out;
+  size_t body_prefix_size = 0; // prefix length at the start of out
+  bool has_messages = false;
+  bool closed = false;
+
+  void build_prefix();
+};
+
+// Appends s to out as a JSON string literal (quotes included)
+void write_string(std::string &out, std::string_view s);
+
 } // namespace json
 
 #endif // JSON_UTILS_H
@@ -0,0 +1,439 @@
+#include "llm_router.h"
+#include "context_manager.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace llm {
+
+// Weight of the newest latency sample in the moving average
+static const double EWMA_ALPHA = 0.3;
+// An unhealthy backend is skipped for COOLDOWN_BASE_MS, doubling with each
+// further failure up to COOLDOWN_MAX_MS
+static const long long COOLDOWN_BASE_MS = 5000;
+static const long long COOLDOWN_MAX_MS = 300000;
+// Latency samples kept per backend, and needed before hedging is trusted
+static const size_t RECENT_SAMPLES = 32;
+static const size_t MIN_HEDGE_SAMPLES = 5;
+
+static long long now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+static std::string read_file(const std::string &path) {
+  std::ifstream t(path, std::ios::binary);
+  if (!t)
+    return "";
+  std::stringstream buffer;
+  buffer << t.rdbuf();
+  return buffer.str();
+}
+
+Router::Router(const std::string &base_dir, const std::string &default_model)
+    : stats_path(base_dir + "backend_stats.json") {
+  load_backends(base_dir + "backends.json", default_model);
+  stats.resize(backend_list.size());
+  load_stats();
+}
+
+void Router::load_backends(const std::string &path, const std::string &model) {
+  std::string content = read_file(path);
+  if (!content.empty()) {
+    json_t j = json_t::parse(content, nullptr, false);
+    if (j.is_array()) {
+      for (const auto &entry : j) {
+        if (!entry.is_object())
+          continue;
+        Backend b;
+        b.name = entry.value("name", "");
+        b.api = entry.value("api", "ollama") == "openai" ? json::ChatApi::openai
+                                                         : json::ChatApi::ollama;
+        b.host = entry.value("host", "localhost");
+        b.port = entry.value("port", b.api == json::ChatApi::openai ? 8080
+                                                                    : 11434);
+        b.model = entry.value("model", "");
+        b.hedge_model = entry.value("hedge_model", "");
+        if (b.name.empty())
+          b.name = b.host + ":" + std::to_string(b.port);
+        backend_list.push_back(b);
+      }
+    }
+  }
+  if (backend_list.empty()) {
+    Backend local;
+    local.name = "local";
+    backend_list.push_back(local);
+  }
+  for (Backend &b : backend_list) {
+    if (b.model.empty())
+      b.model = model;
+  }
+}
+
+std::string Router::stats_key(size_t index) const {
+  const Backend &b = backend_list[index];
+  return b.host + ":" + std::to_string(b.port) + "/" + b.model;
+}
+
+void Router::load_stats() {
+  json_t j = json_t::parse(read_file(stats_path), nullptr, false);
+  if (!j.is_object())
+    return;
+  for (size_t i = 0; i < backend_list.size(); ++i) {
+    auto it = j.find(stats_key(i));
+    if (it == j.end() || !it->is_object())
+      continue;
+    stats[i].ewma_ms = it->value("ewma_ms", 0.0);
+    auto recent = it->find("recent_ms");
+    if (recent != it->end() && recent->is_array()) {
+      for (const auto &v : *recent) {
+        if (v.is_number())
+          stats[i].recent_ms.push_back(v.get<double>());
+      }
+    }
+    stats[i].failures = it->value("failures", 0);
+    stats[i].retry_after = it->value("retry_after", 0LL);
+  }
+}
+
+void Router::save_stats_locked() {
+  // Keep entries of backends not configured right now
+  json_t j = json_t::parse(read_file(stats_path), nullptr, false);
+  if (!j.is_object())
+    j = json_t::object();
+  for (size_t i = 0; i < backend_list.size(); ++i) {
+    j[stats_key(i)] = {{"ewma_ms", stats[i].ewma_ms},
+                       {"recent_ms", stats[i].recent_ms},
+                       {"failures", stats[i].failures},
+                       {"retry_after", stats[i].retry_after}};
+  }
+  ContextManager::write_atomic(stats_path, j.dump(2));
+}
+
+std::vector<size_t> Router::candidates() {
+  std::lock_guard<std::mutex> lock(mutex);
+  long long now = now_ms();
+  std::vector<size_t> order(backend_list.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  // Healthy (or done cooling down) first, fastest first; a backend without
+  // samples sorts as fastest so it gets measured. Backends still cooling
+  // down go last, soonest retry first, as a last resort.
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    bool cooling_a = stats[a].failures > 0 && stats[a].retry_after > now;
+    bool cooling_b = stats[b].failures > 0 && stats[b].retry_after > now;
+    if (cooling_a != cooling_b)
+      return !cooling_a;
+    if (cooling_a)
+      return stats[a].retry_after < stats[b].retry_after;
+    return stats[a].ewma_ms < stats[b].ewma_ms;
+  });
+  return order;
+}
+
+std::string Router::last_backend() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return last_used;
+}
+
+bool Router::last_hedged() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return hedged;
+}
+
+void Router::set_last_call(const std::string &backend, bool was_hedged) {
+  std::lock_guard<std::mutex> lock(mutex);
+  last_used = backend;
+  hedged = was_hedged;
+}
+
+void Router::set_hedge_percentile(double percentile) {
+  std::lock_guard<std::mutex> lock(mutex);
+  hedge_percentile = percentile;
+}
+
+static void add_sample(BackendStats &s, double first_byte_ms) {
+  s.ewma_ms = s.ewma_ms == 0
+                  ? first_byte_ms
+                  : EWMA_ALPHA * first_byte_ms + (1 - EWMA_ALPHA) * s.ewma_ms;
+  s.recent_ms.push_back(first_byte_ms);
+  if (s.recent_ms.size() > RECENT_SAMPLES)
+    s.recent_ms.erase(s.recent_ms.begin());
+}
+
+void Router::report_success(size_t index, double first_byte_ms) {
+  std::lock_guard<std::mutex> lock(mutex);
+  BackendStats &s = stats[index];
+  add_sample(s, first_byte_ms);
+  s.failures = 0;
+  s.retry_after = 0;
+  save_stats_locked();
+}
+
+void Router::report_no_first_byte(size_t index, double waited_ms) {
+  std::lock_guard<std::mutex> lock(mutex);
+  BackendStats &s = stats[index];
+  if (waited_ms <= s.ewma_ms)
+    return;
+  add_sample(s, waited_ms);
+  save_stats_locked();
+}
+
+void Router::report_failure(size_t index) {
+  std::lock_guard<std::mutex> lock(mutex);
+  BackendStats &s = stats[index];
+  s.failures++;
+  long long cooldown = COOLDOWN_BASE_MS << std::min(s.failures - 1, 16);
+  s.retry_after = now_ms() + std::min(cooldown, COOLDOWN_MAX_MS);
+  save_stats_locked();
+}
+
+bool Router::plan_hedge(const std::vector<size_t> &order, HedgePlan &plan) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (hedge_percentile <= 0 || order.empty())
+    return false;
+  plan.primary = order[0];
+  std::vector<double> samples = stats[plan.primary].recent_ms;
+  if (samples.size() < MIN_HEDGE_SAMPLES)
+    return false;
+  std::sort(samples.begin(), samples.end());
+  size_t rank = (size_t)(hedge_percentile / 100.0 * (samples.size() - 1) + 0.5);
+  plan.delay_ms = samples[std::min(rank, samples.size() - 1)];
+
+  const Backend &primary = backend_list[plan.primary];
+  if (!primary.hedge_model.empty()) {
+    plan.hedge = plan.primary;
+    plan.hedge_model = primary.hedge_model;
+    return true;
+  }
+  if (order.size() < 2)
+    return false;
+  // Hedging into a backend that is cooling down would just add a failure
+  const BackendStats &next = stats[order[1]];
+  if (next.failures > 0 && next.retry_after > now_ms())
+    return false;
+  plan.hedge = order[1];
+  plan.hedge_model = backend_list[order[1]].model;
+  return true;
+}
+
+bool Router::chat_hedged(json::ChatRequestWriter &writer,
+                         const http::ChunkCallback &on_chunk,
+                         const http::RequestOptions &options,
+                         const HedgePlan &plan, http::Response &response) {
+  using clock = std::chrono::steady_clock;
+  struct Attempt {
+    size_t index;
+    bool report; // a hedge_model request says nothing about the backend
+    std::string body;
+    http::CancelToken cancel;
+    http::Response response = {0, ""};
+    clock::time_point launched;
+    double first_byte_ms = 0; // from its own launch
+    double waited_ms = 0;     // when cancelled by the other's first byte
+    bool started = false;
+    bool finished = false;
+    std::thread thread;
+  };
+  Attempt attempts[2];
+  attempts[0].index = plan.primary;
+  attempts[0].report = true;
+  attempts[1].index = plan.hedge;
+  attempts[1].report = plan.hedge != plan.primary;
+
+  // Bodies differ in API and model, so each request gets its own copy
+  writer.set_api(backend_list[plan.primary].api);
+  writer.set_model(backend_list[plan.primary].model);
+  attempts[0].body = writer.finish();
+  writer.set_api(backend_list[plan.hedge].api);
+  writer.set_model(plan.hedge_model);
+  attempts[1].body = writer.finish();
+
+  std::mutex m;
+  std::condition_variable cv;
+  int winner = -1;
+  auto start = clock::now();
+  auto ms_since = [](clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(clock::now() - t)
+        .count();
+  };
+
+  // The first request to deliver a byte wins and cancels the other; only
+  // the winner's bytes reach on_chunk
+  auto launch = [&](int k) {
+    attempts[k].launched = clock::now();
+    attempts[k].started = true;
+    attempts[k].thread = std::thread([&, k] {
+      Attempt &a = attempts[k];
+      const Backend &backend = backend_list[a.index];
+      http::RequestOptions attempt_options = options;
+      attempt_options.cancel = &a.cancel;
+      http::Client client(backend.host, backend.port);
+      http::Response r = client.post_stream(
+          backend.chat_path(), a.body,
+          [&](const char *data, size_t len) {
+            {
+              std::lock_guard<std::mutex> lock(m);
+              if (winner < 0) {
+                winner = k;
+                a.first_byte_ms = ms_since(a.launched);
+                Attempt &other = attempts[1 - k];
+                if (other.started)
+                  other.waited_ms = ms_since(other.launched);
+                other.cancel.cancel();
+                cv.notify_all();
+              }
+              if (winner != k)
+                return false;
+            }
+            return on_chunk(data, len);
+          },
+          attempt_options);
+      std::lock_guard<std::mutex> lock(m);
+      a.response = std::move(r);
+      a.finished = true;
+      cv.notify_all();
+    });
+  };
+
+  bool hedge_started = false;
+  bool caller_cancelled = false;
+  auto hedge_at = start + std::chrono::microseconds((long long)(plan.delay_ms * 1000));
+  {
+    std::unique_lock<std::mutex> lock(m);
+    launch(0);
+    while (true) {
+      if (options.cancel && options.cancel->cancelled() && !caller_cancelled) {
+        caller_cancelled = true;
+        attempts[0].cancel.cancel();
+        attempts[1].cancel.cancel();
+      }
+      // Hedge on a slow first byte, or right away if the primary failed
+      bool primary_failed = attempts[0].finished && winner < 0;
+      if (!hedge_started && winner < 0 && !caller_cancelled &&
+          (primary_failed || clock::now() >= hedge_at)) {
+        launch(1);
+        hedge_started = true;
+      }
+      if (attempts[0].finished && (!hedge_started || attempts[1].finished))
+        break;
+      auto wake = clock::now() + std::chrono::milliseconds(50);
+      if (!hedge_started && hedge_at < wake)
+        wake = hedge_at;
+      cv.wait_until(lock, wake);
+    }
+  }
+  for (Attempt &a : attempts) {
+    if (a.thread.joinable())
+      a.thread.join();
+  }
+
+  int used = winner >= 0 ? winner : (hedge_started ? 1 : 0);
+  if (winner < 0 && hedge_started && attempts[1].response.status_code == 0)
+    used = 0; // report the primary's answer when the hedge got nowhere
+  response = std::move(attempts[used].response);
+  set_last_call(backend_list[attempts[used].index].name, hedge_started);
+  if (caller_cancelled) {
+    response.failure = http::Failure::cancelled;
+    return true;
+  }
+
+  for (int k = 0; k < (hedge_started ? 2 : 1); ++k) {
+    Attempt &a = attempts[k];
+    const http::Response &r = k == used ? response : a.response;
+    if (!a.report)
+      continue;
+    if (k == winner) {
+      if (r.failure == http::Failure::none)
+        report_success(a.index, a.first_byte_ms);
+      else
+        report_failure(a.index);
+    } else if (winner >= 0 && r.failure == http::Failure::cancelled) {
+      // Lost the race: no first byte after waiting this long
+      report_no_first_byte(a.index, a.waited_ms);
+    } else if (r.status_code == 0 || r.status_code >= 500 ||
+               r.failure != http::Failure::none) {
+      report_failure(a.index);
+    }
+  }
+  if (winner >= 0)
+    return true;
+  // No bytes at all: final only for answers such as an unknown model
+  return response.status_code != 0 && response.status_code < 500;
+}
+
+http::Response Router::chat(json::ChatRequestWriter &writer,
+                            const http::ChunkCallback &on_chunk,
+                            const http::RequestOptions &options) {
+  using clock = std::chrono::steady_clock;
+  http::Response response = {0, ""};
+  std::vector<size_t> order = candidates();
+
+  HedgePlan plan;
+  if (on_chunk && plan_hedge(order, plan)) {
+    if (chat_hedged(writer, on_chunk, options, plan, response))
+      return response;
+    order.erase(std::remove_if(order.begin(), order.end(),
+                               [&](size_t i) {
+                                 return i == plan.primary || i == plan.hedge;
+                               }),
+                order.end());
+  }
+
+  for (size_t index : order) {
+    const Backend &backend = backend_list[index];
+    writer.set_api(backend.api);
+    writer.set_model(backend.model);
+
+    auto start = clock::now();
+    double first_byte_ms = 0;
+    http::ChunkCallback timed_chunk;
+    if (on_chunk) {
+      timed_chunk = [&](const char *data, size_t len) {
+        if (first_byte_ms == 0)
+          first_byte_ms =
+              std::chrono::duration<double, std::milli>(clock::now() - start)
+                  .count();
+        return on_chunk(data, len);
+      };
+    }
+
+    http::Client client(backend.host, backend.port);
+    response = on_chunk ? client.post_stream(backend.chat_path(),
+                                             writer.finish(), timed_chunk,
+                                             options)
+                        : client.post(backend.chat_path(), writer.finish(),
+                                      options);
+    set_last_call(backend.name, false);
+
+    if (response.failure == http::Failure::cancelled)
+      return response;
+    bool got_content = first_byte_ms > 0;
+    bool failed = response.status_code == 0 || response.status_code >= 500 ||
+                  response.failure != http::Failure::none;
+    if (!failed) {
+      if (response.status_code == 200) {
+        if (!got_content)
+          first_byte_ms =
+              std::chrono::duration<double, std::milli>(clock::now() - start)
+                  .count();
+        report_success(index, first_byte_ms);
+      }
+      // Client errors (unknown model, bad request) are not the backend's
+      // health problem and would fail the same way elsewhere
+      return response;
+    }
+    report_failure(index);
+    // Once content reached the caller, another backend cannot take over
+    if (got_content)
+      return response;
+  }
+  return response;
+}
+
+} // namespace llm
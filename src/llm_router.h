@@ -0,0 +1,117 @@
+#ifndef LLM_ROUTER_H
+#define LLM_ROUTER_H
+
+#include "http_client.h"
+#include "json_utils.h"
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace llm {
+
+// One chat endpoint: a local or remote Ollama, or any server speaking the
+// OpenAI /v1/chat/completions dialect (llama.cpp server, vLLM, LM Studio)
+struct Backend {
+  std::string name;
+  json::ChatApi api = json::ChatApi::ollama;
+  std::string host = "localhost";
+  int port = 11434;
+  std::string model; // filled with the session model when not configured
+  // Optional smaller model on the same server to hedge slow requests with
+  std::string hedge_model;
+
+  const char *chat_path() const {
+    return api == json::ChatApi::openai ? "/v1/chat/completions"
+                                        : "/api/chat";
+  }
+};
+
+// What the router remembers per backend
+struct BackendStats {
+  double ewma_ms = 0;            // time to first reply byte; 0 = no sample yet
+  std::vector<double> recent_ms; // latest samples, for hedging percentiles
+  int failures = 0;              // consecutive
+  long long retry_after = 0; // unix ms; an unhealthy backend waits until then
+};
+
+// Sends each chat request to the fastest healthy backend and fails over to
+// the next one when a backend cannot be reached, times out or answers 5xx
+// before any content arrived. Backends come from <base_dir>backends.json:
+//
+//   [{"name": "local", "api": "ollama", "host": "localhost", "port": 11434},
+//    {"name": "gpu-box", "api": "openai", "host": "10.0.0.5", "port": 8080,
+//     "model": "qwen2.5-coder"}]
+//
+// Without that file the only backend is the local Ollama. Latency (EWMA of
+// time to first byte) and health are kept in <base_dir>backend_stats.json so
+// they carry over between invocations. Safe to use from several threads.
+//
+// Streaming requests are hedged: when no byte arrived within the configured
+// percentile of the backend's recent times to first byte, the same request
+// goes to the next backend (or to the backend's "hedge_model"), the first
+// one to answer is used and the other is cancelled.
+class Router {
+public:
+  Router(const std::string &base_dir, const std::string &default_model);
+
+  // Sends the messages in writer (model and API are set per backend). A 200
+  // body goes to on_chunk if given, otherwise into Response::body.
+  http::Response chat(json::ChatRequestWriter &writer,
+                      const http::ChunkCallback &on_chunk = nullptr,
+                      const http::RequestOptions &options =
+                          http::RequestOptions());
+
+  const std::vector<Backend> &backends() const { return backend_list; }
+  // Backend indexes in the order chat() tries them
+  std::vector<size_t> candidates();
+  // Name of the backend that answered the last chat() call
+  std::string last_backend();
+  // Whether the last chat() call sent a hedge request
+  bool last_hedged();
+
+  // Percentile (e.g. 95) of recent times to first byte after which a
+  // streaming request is hedged; 0 disables hedging
+  void set_hedge_percentile(double percentile);
+
+  // Feeds one observation into a backend's latency/health
+  void report_success(size_t index, double first_byte_ms);
+  void report_failure(size_t index);
+  // A request cancelled after waiting waited_ms for its first byte (a
+  // hedge race loser). That only bounds the time from below, so it is a
+  // sample only when already slower than the backend's average; no health
+  // change either way.
+  void report_no_first_byte(size_t index, double waited_ms);
+
+private:
+  std::string stats_path;
+  std::vector<Backend> backend_list;
+  std::vector<BackendStats> stats;
+  std::string last_used;
+  bool hedged = false;
+  double hedge_percentile = 0;
+  std::mutex mutex;
+
+  struct HedgePlan {
+    size_t primary = 0;
+    size_t hedge = 0;        // backend index of the hedge request
+    std::string hedge_model; // model of the hedge request
+    double delay_ms = 0;
+  };
+  bool plan_hedge(const std::vector<size_t> &order, HedgePlan &plan);
+  // Returns false if neither request got anywhere and the caller should fail
+  // over to the remaining backends
+  bool chat_hedged(json::ChatRequestWriter &writer,
+                   const http::ChunkCallback &on_chunk,
+                   const http::RequestOptions &options, const HedgePlan &plan,
+                   http::Response &response);
+  void set_last_call(const std::string &backend, bool was_hedged);
+
+  void load_backends(const std::string &path, const std::string &model);
+  void load_stats();
+  void save_stats_locked();
+  std::string stats_key(size_t index) const;
+};
+
+} // namespace llm
+
+#endif // LLM_ROUTER_H
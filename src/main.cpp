@@ -3,18 +3,34 @@
 #include "context_manager.h"
 #include "http_client.h"
 #include "json_utils.h"
+#include "llm_router.h"
 #include "memory.h"  // Include memory manager
+#include "plan_executor.h"
 #include "wrapper.h" // Include wrapper
 #include <algorithm>
 #include <chrono>
+#include <csignal>
 #include <cstdlib>
+#include <functional>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
+#ifdef _WIN32
 #include <windows.h> // For GetModuleFileNameA and MAX_PATH
+#else
+#include <climits>
+#include <sys/utsname.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+#endif
 
 // ANSI Color Codes
 #define RESET "\033[0m"
@@ -45,28 +61,59 @@ void clear_screen() {
 #endif
 }
 
+// A local server answers "/" immediately; don't wait on a wedged one
+http::RequestOptions readiness_probe_options() {
+  http::RequestOptions options;
+  options.connect_timeout_ms = 1000;
+  options.first_byte_timeout_ms = 2000;
+  options.total_timeout_ms = 3000;
+  return options;
+}
+
 bool is_ollama_ready() {
   http::Client client("localhost", 11434);
-  http::Response resp = client.get("/");
+  // A bare TCP connect first: with nothing listening it fails within the
+  // short connect timeout (Windows retries a refused SYN for about a
+  // second, so the timeout, not the refusal, ends it there); only a server
+  // that accepts is worth asking over HTTP
+  if (!client.is_reachable())
+    return false;
+  http::Response resp = client.get("/", readiness_probe_options());
   return resp.status_code == 200;
 }
 
-void ensure_ollama_running() {
-  if (is_ollama_ready())
-    return;
+// Polling for a freshly started server: the first checks come a few ms
+// apart, then back off up to READY_POLL_MAX_MS, for READY_WAIT_MS in total.
+static const int READY_POLL_START_MS = 5;
+static const int READY_POLL_MAX_MS = 500;
+static const int READY_WAIT_MS = 10000;
 
+// Starts a local Ollama server and waits until it answers
+void start_ollama_and_wait() {
+  using clock = std::chrono::steady_clock;
   std::cout << YELLOW << "Ollama is not running. Starting local server..."
             << RESET << "\n";
+#ifdef _WIN32
   std::system("start /B ollama serve > nul 2>&1");
+#else
+  std::system("ollama serve > /dev/null 2>&1 &");
+#endif
 
   std::cout << GRAY << "Waiting for Ollama to be ready..." << RESET;
-  for (int i = 0; i < 20; ++i) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  auto start = clock::now();
+  auto last_dot = start;
+  int delay_ms = READY_POLL_START_MS;
+  while (clock::now() - start < std::chrono::milliseconds(READY_WAIT_MS)) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+    delay_ms = std::min(delay_ms * 2, READY_POLL_MAX_MS);
     if (is_ollama_ready()) {
       std::cout << GREEN << " Done." << RESET << "\n";
       return;
     }
-    std::cout << "." << std::flush;
+    if (clock::now() - last_dot >= std::chrono::milliseconds(500)) {
+      last_dot = clock::now();
+      std::cout << "." << std::flush;
+    }
   }
   std::cout
       << RED
@@ -74,11 +121,71 @@ void ensure_ollama_running() {
       << RESET << "\n";
 }
 
-std::string select_model() {
+void ensure_ollama_running() {
+  if (!is_ollama_ready())
+    start_ollama_and_wait();
+}
+
+// Readiness probe started in the background at startup. Only paths that talk
+// to the model call ensure_running(), so a cache hit never waits for it.
+class OllamaReadiness {
+public:
+  OllamaReadiness()
+      : probe(http::Client("localhost", 11434)
+                  .get_async("/", readiness_probe_options())) {}
+
+  void ensure_running() {
+    if (checked)
+      return;
+    checked = true;
+    if (probe.get().status_code != 200)
+      start_ollama_and_wait();
+  }
+
+  // Whether Ollama is known to be up, without waiting for the probe or
+  // starting the server
+  bool running_now() const {
+    return checked ||
+           (probe.wait_for(std::chrono::seconds(0)) ==
+                std::future_status::ready &&
+            probe.get().status_code == 200);
+  }
+
+private:
+  std::shared_future<http::Response> probe;
+  bool checked = false;
+};
+
+// Whether the router may send requests to the Ollama on this machine, which
+// is then worth starting and warming up
+bool uses_local_ollama(const llm::Router &router) {
+  for (const llm::Backend &b : router.backends()) {
+    if (b.api == json::ChatApi::ollama && b.port == 11434 &&
+        (b.host == "localhost" || b.host == "127.0.0.1"))
+      return true;
+  }
+  return false;
+}
+
+// Loads the model in the background (a chat request without messages) so it
+// is resident by the time the prompt is assembled and sent
+void start_model_warm_up(const AiContext &ctx) {
+  json::ChatRequestWriter w;
+  w.set_model(ctx.model_name);
+  w.set_stream(false);
+  w.set_keep_alive(ctx.keep_alive);
+  w.begin();
+  http::RequestOptions options;
+  options.total_timeout_ms = 60000;
+  // Fire and forget: the generation request does not depend on the answer
+  http::Client("localhost", 11434).post_async("/api/chat", w.finish(), options);
+}
+
+// tags is the pending GET /api/tags, started before the environment probing
+std::string select_model(std::future<http::Response> tags) {
   clear_screen();
   std::cout << YELLOW << "Fetching local models..." << RESET << "\n";
-  http::Client client("localhost", 11434);
-  http::Response resp = client.get("/api/tags");
+  http::Response resp = tags.get();
   std::vector<std::string> models;
   if (resp.status_code == 200)
     models = json::extract_model_names(resp.body);
@@ -115,9 +222,24 @@ std::string select_environment(const std::string &model) {
                                                             // file rewrite
 }
 
-#include <windows.h>
-
 std::string get_os_string() {
+#ifndef _WIN32
+  // PRETTY_NAME from os-release where there is one (Linux), else uname
+  std::ifstream release("/etc/os-release");
+  std::string line;
+  while (std::getline(release, line)) {
+    if (line.rfind("PRETTY_NAME=", 0) == 0) {
+      std::string name = line.substr(12);
+      name.erase(std::remove(name.begin(), name.end(), '"'), name.end());
+      if (!name.empty())
+        return name;
+    }
+  }
+  struct utsname info;
+  if (uname(&info) == 0)
+    return std::string(info.sysname) + " " + info.release;
+  return "Unix (Unknown)";
+#else
   std::string os_name = "Windows (Unknown)";
   HKEY hKey;
   char value[255];
@@ -132,31 +254,50 @@ std::string get_os_string() {
     RegCloseKey(hKey);
   }
   return os_name;
+#endif
 }
 
 std::string get_detected_shell() {
+#ifdef _WIN32
   if (std::getenv("PSModulePath") != nullptr) {
     return "PowerShell (Available)";
   }
   return "CMD";
+#else
+  // Commands run under bash when it is $SHELL, else sh (wrap_posix_shell)
+  const char *shell = std::getenv("SHELL");
+  std::string name = shell ? shell : "";
+  name = name.substr(name.find_last_of('/') + 1);
+  return name == "bash" ? "bash" : "sh";
+#endif
 }
 
 std::string get_username() {
+#ifdef _WIN32
   const char *user = std::getenv("USERNAME");
+#else
+  const char *user = std::getenv("USER");
+#endif
   if (user)
     return std::string(user);
   return "Unknown";
 }
 
 void setup_context(ContextManager &cm) {
-  std::string model = select_model();
-  AiContext ctx;
-  ctx.model_name = model;
-  ctx.operating_mode = "Translator";
+  // List the models while the environment is detected
+  http::RequestOptions options;
+  options.total_timeout_ms = 10000;
+  std::future<http::Response> tags =
+      http::Client("localhost", 11434).get_async("/api/tags", options);
 
   std::string os = get_os_string();
   std::string shell = get_detected_shell();
   std::string username = get_username();
+
+  std::string model = select_model(std::move(tags));
+  AiContext ctx;
+  ctx.model_name = model;
+  ctx.operating_mode = "Translator";
   ctx.env_block =
       "Operating System: " + os + "\nShell: " + shell + "\nUser: " + username;
 
@@ -166,26 +307,29 @@ void setup_context(ContextManager &cm) {
             << " / User: " << username << RESET << "\n";
 }
 
-void load_history_into_builder(json::Builder &builder,
-                               const std::string &transcript) {
-  if (transcript.empty())
-    return;
+// Appends the transcript's USER/ASSISTANT turns as messages. Works on views
+// into the transcript, so no segment is copied before serialization.
+void load_history_into_request(json::ChatRequestWriter &writer,
+                               std::string_view transcript) {
+  const char *ws = " \t\n\r\f\v";
   size_t pos = 0;
   while (pos < transcript.length()) {
     size_t next_sep = transcript.find("|||", pos);
-    if (next_sep == std::string::npos)
+    if (next_sep == std::string_view::npos)
       break;
-    std::string segment = transcript.substr(pos, next_sep - pos);
+    std::string_view segment = transcript.substr(pos, next_sep - pos);
 
     // Trim segment
-    const char *ws = " \t\n\r\f\v";
-    segment.erase(0, segment.find_first_not_of(ws));
-    segment.erase(segment.find_last_not_of(ws) + 1);
+    size_t first = segment.find_first_not_of(ws);
+    if (first == std::string_view::npos)
+      segment = {};
+    else
+      segment = segment.substr(first, segment.find_last_not_of(ws) - first + 1);
 
-    if (segment.find("USER: ") == 0)
-      builder.add_message("user", segment.substr(6));
-    else if (segment.find("ASSISTANT: ") == 0)
-      builder.add_message("assistant", segment.substr(11));
+    if (segment.substr(0, 6) == "USER: ")
+      writer.add_message("user", segment.substr(6));
+    else if (segment.substr(0, 11) == "ASSISTANT: ")
+      writer.add_message("assistant", segment.substr(11));
 
     pos = next_sep + 3;
   }
@@ -195,9 +339,19 @@ void load_history_into_builder(json::Builder &builder,
 
 // Get directory where the executable is located
 std::string get_exe_directory() {
+#ifdef _WIN32
   char path[MAX_PATH];
   GetModuleFileNameA(NULL, path, MAX_PATH);
   std::string full_path(path);
+#elif defined(__APPLE__)
+  char path[PATH_MAX];
+  uint32_t size = sizeof(path);
+  std::string full_path = _NSGetExecutablePath(path, &size) == 0 ? path : "";
+#else
+  char path[PATH_MAX];
+  ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+  std::string full_path(path, len > 0 ? (size_t)len : 0);
+#endif
   size_t last_slash = full_path.find_last_of("\\/");
   if (last_slash != std::string::npos) {
     return full_path.substr(0, last_slash + 1);
@@ -325,19 +479,190 @@ std::string post_process_command(const std::string &cmd) {
   return processed;
 }
 
-// Automatic retry with AI-generated fix
-std::string attempt_auto_fix(const std::string &failed_command,
-                             const std::string &error_msg,
-                             const std::string &user_request,
-                             const std::string &model_name,
-                             const std::string &system_prompt) {
-  std::cout << YELLOW << "[Auto-Retry] Attempting to fix command..." << RESET
-            << "\n";
+// Generation limits matching the single-line command contract: a command
+// never needs more than a few hundred tokens, and a blank line means the model
+// has moved on to explaining itself.
+static const int COMMAND_NUM_PREDICT = 384;
+static const std::vector<std::string> COMMAND_STOP = {"\n\n"};
+
+struct StreamedCommand {
+  http::Response response;
+  std::string backend;      // router backend that answered
+  bool hedged = false;      // a duplicate request raced the first one
+  std::string command;      // reply cut where it was complete
+  std::string error;        // error reported inside the stream
+  json::ChatTimings timings; // only filled when the stream ran to the end
+  double first_token_ms = 0; // client-side, from request start
+  double total_ms = 0;
+};
+
+// Cancelled by Ctrl+C while a generation request is in flight
+http::CancelToken g_generation_cancel;
+
+#ifdef _WIN32
+BOOL WINAPI cancel_generation_on_ctrl(DWORD type) {
+  if (type == CTRL_C_EVENT || type == CTRL_BREAK_EVENT) {
+    g_generation_cancel.cancel();
+    return TRUE;
+  }
+  return FALSE;
+}
+#else
+void cancel_generation_on_sigint(int) { g_generation_cancel.cancel(); }
+#endif
 
-  json::Builder fix_builder;
-  fix_builder.add("model", model_name);
-  fix_builder.add("stream", false);
+// While alive, Ctrl+C cancels the generation instead of killing the process,
+// so the preview can be cleaned up and the connection closed properly.
+struct CancelGenerationOnInterrupt {
+  CancelGenerationOnInterrupt() {
+    g_generation_cancel.reset();
+#ifdef _WIN32
+    SetConsoleCtrlHandler(cancel_generation_on_ctrl, TRUE);
+#else
+    previous = std::signal(SIGINT, cancel_generation_on_sigint);
+#endif
+  }
+  ~CancelGenerationOnInterrupt() {
+#ifdef _WIN32
+    SetConsoleCtrlHandler(cancel_generation_on_ctrl, FALSE);
+#else
+    std::signal(SIGINT, previous);
+#endif
+  }
 
+#ifndef _WIN32
+  void (*previous)(int) = SIG_DFL;
+#endif
+};
+
+// Percentile of recent first-byte times after which a generation request is
+// duplicated to another backend; AI_SHELL_HEDGE_PERCENTILE=0 turns it off
+double hedge_percentile() {
+  const char *value = std::getenv("AI_SHELL_HEDGE_PERCENTILE");
+  if (!value || !*value)
+    return 95;
+  double p = std::atof(value);
+  return p < 0 ? 0 : (p > 100 ? 100 : p);
+}
+
+// Streams a chat completion from the router's fastest backend and stops
+// reading as soon as find_end finds the end of what was asked for in the
+// reply so far. Dropping the connection makes the server abort the rest of
+// the generation. on_delta sees the raw deltas. Ctrl+C cancels the request,
+// unless the caller passes its own cancel token.
+StreamedCommand stream_reply(
+    llm::Router &router, json::ChatRequestWriter &request_writer,
+    const std::function<void(const std::string &)> &on_delta,
+    size_t (*find_end)(const std::string &), http::CancelToken *cancel) {
+  using clock = std::chrono::steady_clock;
+  StreamedCommand result;
+  json::ChatStreamParser parser;
+  size_t command_end = std::string::npos;
+  auto start = clock::now();
+  auto elapsed_ms = [&] {
+    return std::chrono::duration<double, std::milli>(clock::now() - start)
+        .count();
+  };
+
+  std::optional<CancelGenerationOnInterrupt> interrupt_guard;
+  if (!cancel) {
+    interrupt_guard.emplace();
+    cancel = &g_generation_cancel;
+  }
+  http::RequestOptions options;
+  options.cancel = cancel;
+
+  result.response = router.chat(
+      request_writer,
+      [&](const char *data, size_t len) {
+        std::string delta = parser.feed(data, len);
+        if (!delta.empty() && result.first_token_ms == 0)
+          result.first_token_ms = elapsed_ms();
+        if (on_delta)
+          on_delta(delta);
+        command_end = find_end(parser.content());
+        return command_end == std::string::npos;
+      },
+      options);
+  if (command_end == std::string::npos) {
+    std::string tail = parser.finish();
+    if (on_delta)
+      on_delta(tail);
+  }
+  result.total_ms = elapsed_ms();
+  result.backend = router.last_backend();
+  result.hedged = router.last_hedged();
+
+  result.command = parser.content();
+  if (command_end != std::string::npos)
+    result.command.erase(command_end);
+  result.error = parser.error();
+  result.timings = parser.timings();
+  return result;
+}
+
+// stream_reply for one complete command (see find_command_end)
+StreamedCommand stream_single_line_command(
+    llm::Router &router, json::ChatRequestWriter &request_writer,
+    const std::function<void(const std::string &)> &on_delta,
+    http::CancelToken *cancel = nullptr) {
+  return stream_reply(router, request_writer, on_delta, find_command_end,
+                      cancel);
+}
+
+// Prints model latency when AI_SHELL_TIMING is set
+void log_model_timing(const char *label, const StreamedCommand &streamed) {
+  if (!std::getenv("AI_SHELL_TIMING"))
+    return;
+  std::cout << GRAY << "[Timing] " << label << " (" << streamed.backend
+            << (streamed.hedged ? ", hedged" : "") << "): first token " << (long long)streamed.first_token_ms
+            << " ms, total " << (long long)streamed.total_ms << " ms";
+  const json::ChatTimings &t = streamed.timings;
+  if (t.present()) {
+    std::cout << ", load " << t.load_duration / 1000000 << " ms, prefill "
+              << t.prompt_eval_count << " tok / "
+              << t.prompt_eval_duration / 1000000 << " ms, decode "
+              << t.eval_count << " tok / " << t.eval_duration / 1000000
+              << " ms";
+  } else {
+    std::cout << " (stopped early, no server timings)";
+  }
+  std::cout << RESET << "\n";
+}
+
+// Prints why a generation request failed and returns the exit code for it,
+// or returns 0 if it did not fail
+int generation_failure_code(const StreamedCommand &streamed) {
+  if (streamed.response.failure == http::Failure::cancelled) {
+    std::cerr << YELLOW << "Cancelled." << RESET << "\n";
+    return 130;
+  }
+  if (streamed.response.failure == http::Failure::timeout) {
+    std::cerr << RED << "Error: " << streamed.backend
+              << " did not answer in time." << RESET << "\n";
+    return 1;
+  }
+  if (streamed.response.status_code != 200) {
+    std::cerr << RED << "Error: " << streamed.backend << " returned HTTP "
+              << streamed.response.status_code << RESET << "\n";
+    return 1;
+  }
+  if (!streamed.error.empty()) {
+    std::cerr << RED << "Error: " << streamed.error << RESET << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+// Asks the model for an alternative to a failed command, without printing
+// anything. The cleaned-up fix is in the result's command, which is empty if
+// the request failed. cancel as in stream_single_line_command.
+StreamedCommand generate_fix(const std::string &failed_command,
+                             const std::string &error_msg,
+                             const std::string &user_request,
+                             llm::Router &router,
+                             json::ChatRequestWriter &request_writer,
+                             http::CancelToken *cancel = nullptr) {
   std::string fix_prompt =
       "The following command FAILED:\n"
       "USER REQUEST: " +
@@ -370,17 +695,19 @@ std::string attempt_auto_fix(const std::string &failed_command,
   // Debug: verify prompt content
   // std::cout << "[DEBUG] Fix Prompt:\n" << fix_prompt << "\n";
 
-  fix_builder.add_message("system", system_prompt);
-  fix_builder.add_message("user", fix_prompt);
+  // Same model/options/system prefix as the original request
+  request_writer.begin();
+  request_writer.add_message("user", fix_prompt);
 
-  http::Client client("localhost", 11434);
-  http::Response resp = client.post("/api/chat", fix_builder.build());
+  StreamedCommand streamed =
+      stream_single_line_command(router, request_writer, nullptr, cancel);
 
-  if (resp.status_code != 200) {
-    return "";
+  if (streamed.response.status_code != 200 || !streamed.error.empty() ||
+      streamed.response.failure != http::Failure::none) {
+    streamed.command.clear();
+    return streamed;
   }
-
-  std::string fixed_cmd = json::extract_response_content(resp.body);
+  std::string &fixed_cmd = streamed.command;
 
   // Trim whitespace
   const char *ws = " \t\n\r\f\v";
@@ -424,7 +751,111 @@ std::string attempt_auto_fix(const std::string &failed_command,
     fixed_cmd.erase(fixed_cmd.find_last_not_of(ws) + 1);
   }
 
-  return fixed_cmd;
+  return streamed;
+}
+
+// Automatic retry with AI-generated fix
+std::string attempt_auto_fix(const std::string &failed_command,
+                             const std::string &error_msg,
+                             const std::string &user_request,
+                             llm::Router &router,
+                             json::ChatRequestWriter &request_writer) {
+  std::cout << YELLOW << "[Auto-Retry] Attempting to fix command..." << RESET
+            << "\n";
+  StreamedCommand streamed = generate_fix(failed_command, error_msg,
+                                          user_request, router, request_writer);
+  log_model_timing("auto-fix", streamed);
+  return streamed.command;
+}
+
+// A fix requested while the failing command still runs, as soon as its
+// stderr shows it failed (see execute_command_safely's on_failure), so that
+// it is ready or nearly so when the command exits. It owns the request
+// writer until taken or discarded, and Ctrl+C does not cancel it: the
+// command has the console meanwhile.
+class SpeculativeFix {
+public:
+  ~SpeculativeFix() { discard(); }
+
+  void start(const std::string &failed_command, const std::string &error_msg,
+             const std::string &user_request, llm::Router &router,
+             json::ChatRequestWriter &request_writer) {
+    if (pending.valid())
+      return;
+    pending = std::async(std::launch::async, [this, failed_command,
+                                              error_msg, user_request,
+                                              &router, &request_writer] {
+      return generate_fix(failed_command, error_msg, user_request, router,
+                          request_writer, &cancel);
+    });
+  }
+
+  bool started() const { return pending.valid(); }
+
+  // Waits for the fix if it is still being generated
+  StreamedCommand take() { return pending.get(); }
+
+  // The command succeeded after all: drop the request
+  void discard() {
+    if (!pending.valid())
+      return;
+    cancel.cancel();
+    pending.wait();
+    pending = std::future<StreamedCommand>();
+  }
+
+private:
+  http::CancelToken cancel;
+  std::future<StreamedCommand> pending;
+};
+
+// Records one command execution and what it cost in the memory log; with
+// AI_SHELL_TIMING also prints the cost. fix is the command that worked
+// instead, if any.
+void log_command_run(MemoryManager &mem, const std::string &user_request,
+                     const std::string &command,
+                     const ProcessRunner::Result &run,
+                     const std::string &fix) {
+  const ProcessRunner::Usage &usage = run.usage;
+  if (usage.wall_ms == 0)
+    return; // suppressed, never ran
+
+  if (std::getenv("AI_SHELL_TIMING")) {
+    std::cout << GRAY << "[Timing] command: wall " << (long long)usage.wall_ms
+              << " ms, CPU " << (long long)usage.user_cpu_ms << " ms user + "
+              << (long long)usage.sys_cpu_ms << " ms sys, peak memory "
+              << usage.peak_rss_bytes / (1024 * 1024) << " MiB, output "
+              << run.stdout_info.bytes << " + " << run.stderr_info.bytes
+              << " bytes" << RESET << "\n";
+  }
+
+  MemoryEntry entry;
+  entry.user_request = user_request;
+  entry.command = command;
+#ifdef _WIN32
+  char cwd[MAX_PATH];
+  DWORD cwd_len = GetCurrentDirectoryA(MAX_PATH, cwd);
+  if (cwd_len > 0 && cwd_len < MAX_PATH)
+    entry.cwd.assign(cwd, cwd_len);
+#else
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)))
+    entry.cwd = cwd;
+#endif
+  entry.exit_code = run.exit_code;
+  entry.status = run.exit_code == 0 ? "success" : "fail";
+  // First line of stderr identifies the error well enough
+  std::string first_line = run.stderr_output.substr(
+      0, run.stderr_output.find_first_of("\r\n"));
+  entry.error_signature = first_line.substr(0, 200);
+  entry.fix = fix;
+  entry.wall_ms = usage.wall_ms;
+  entry.user_cpu_ms = usage.user_cpu_ms;
+  entry.sys_cpu_ms = usage.sys_cpu_ms;
+  entry.peak_rss_kb = usage.peak_rss_bytes / 1024;
+  entry.stdout_bytes = run.stdout_info.bytes;
+  entry.stderr_bytes = run.stderr_info.bytes;
+  mem.log_execution(entry);
 }
 
 // Optimize command for cache: if success but with stderr, extract the fallback
@@ -466,13 +897,105 @@ std::string optimize_command_for_cache(const std::string &cmd,
   return cmd;
 }
 
+// ai --plan: the reply is a plan of steps instead of one command (see
+// plan_executor.h). It is a JSON object of a few commands, far longer than
+// one command and with blank lines allowed, so the command limits do not
+// apply.
+static const char *const PLAN_INSTRUCTION =
+    "PLAN MODE: Instead of one command, break the request into a few "
+    "steps, each ONE single-line command for this shell. Steps that do not "
+    "depend on each other run at the same time, so only list a step in "
+    "\"after\" if it needs that step's result. Reply with ONLY this JSON "
+    "object, no explanation:\n"
+    "{\"steps\": [{\"id\": \"short-name\", \"command\": \"...\", "
+    "\"after\": []}, {\"id\": \"next\", \"command\": \"...\", "
+    "\"after\": [\"short-name\"]}]}";
+static const int PLAN_NUM_PREDICT = 1024;
+
+// Generates a plan for the request, shows it, and runs it once confirmed.
+// Returns the exit code: 0 only if every step succeeded.
+int run_plan_request(const std::string &user_request, AiContext &ctx,
+                     ContextManager &cm, llm::Router &router,
+                     json::ChatRequestWriter &request_writer,
+                     OllamaReadiness &ollama) {
+  if (uses_local_ollama(router)) {
+    ollama.ensure_running();
+    start_model_warm_up(ctx);
+  }
+  request_writer.set_generation_options(PLAN_NUM_PREDICT, {});
+  request_writer.begin();
+  request_writer.add_message("system", PLAN_INSTRUCTION);
+  request_writer.add_message("user", user_request);
+
+  std::cout << GRAY << "Planning...\r" << RESET;
+  std::flush(std::cout);
+  StreamedCommand streamed =
+      stream_reply(router, request_writer, nullptr, find_plan_end, nullptr);
+  std::cout << "\r\033[K";
+  if (int code = generation_failure_code(streamed))
+    return code;
+  log_model_timing("plan", streamed);
+
+  std::vector<PlanStep> steps;
+  std::string error;
+  if (!parse_plan(streamed.command, steps, error)) {
+    std::cerr << RED << "Error: the model's plan is unusable: " << error
+              << RESET << "\n";
+    return 1;
+  }
+
+  int jobs = plan_jobs_from_env();
+  std::cout << GREEN << "Plan (" << steps.size() << " steps, up to " << jobs
+            << " at a time):" << RESET << "\n";
+  for (const PlanStep &step : steps) {
+    std::cout << GREEN << "  " << step.id << ": " << step.command << RESET;
+    if (!step.after.empty())
+      std::cout << GRAY << "  (after " << join(step.after, ", ") << ")"
+                << RESET;
+    std::cout << "\n";
+  }
+  std::cout << "\nExecute? [Y/n] ";
+  std::string ans;
+  std::flush(std::cout);
+  std::getline(std::cin, ans);
+  if (!(ans.empty() || ans == "y" || ans == "Y")) {
+    std::cout << YELLOW << "Cancelled." << RESET << "\n";
+    return 0;
+  }
+
+  std::vector<StepOutcome> outcomes =
+      run_plan(steps, jobs, run_options_from_env());
+  size_t counts[3] = {0, 0, 0};
+  for (const StepOutcome &outcome : outcomes)
+    ++counts[(int)outcome.status];
+  bool all_ok = counts[0] == steps.size();
+  std::cout << (all_ok ? GREEN : RED) << "Plan finished: " << counts[0]
+            << " succeeded, " << counts[1] << " failed, " << counts[2]
+            << " skipped." << RESET << "\n";
+
+  // History sees the plan as its commands, each with its outcome
+  std::string commands, results;
+  for (size_t i = 0; i < steps.size(); ++i) {
+    const char *status[] = {"SUCCESS", "FAILED", "SKIPPED"};
+    commands += (i ? " ; " : "") + steps[i].command;
+    results += std::string(i ? " " : "") + "[" + steps[i].id + ": " +
+               status[(int)outcomes[i].status] + "]";
+  }
+  ctx.transcript += "USER: " + user_request + " ||| ASSISTANT: " + commands +
+                    " ||| RESULT: " + results + " ||| ";
+  cm.save_context(ctx);
+  return all_ok ? 0 : 1;
+}
+
 int main(int argc, char *argv[]) {
   std::string exe_dir = get_exe_directory();
+#ifdef _WIN32
   // Enable UTF-8 Support
   SetConsoleOutputCP(CP_UTF8);
   SetConsoleCP(CP_UTF8);
+#endif
 
-  ContextManager cm(exe_dir + "context.json");
+  ContextManager cm(exe_dir);
   std::vector<std::string> args;
   for (int i = 1; i < argc; ++i)
     args.push_back(argv[i]);
@@ -497,6 +1020,23 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+  if (args[0] == "--keep-alive") {
+    AiContext ctx;
+    if (!cm.load_context(ctx)) {
+      std::cerr << "Run ai without arguments to set up first.\n";
+      return 1;
+    }
+    if (args.size() < 2) {
+      std::cout << "keep_alive: " << ctx.keep_alive << "\n";
+      return 0;
+    }
+    ctx.keep_alive = args[1];
+    cm.save_context(ctx);
+    std::cout << GREEN << "keep_alive set to " << ctx.keep_alive << RESET
+              << "\n";
+    return 0;
+  }
+
   if (args[0] == "--optimize-memory") {
     std::cout << YELLOW << "Optimizing memory..." << RESET << "\n";
     MemoryManager mem(exe_dir + "terminal_memory.jsonl");
@@ -517,18 +1057,33 @@ int main(int argc, char *argv[]) {
 
     // Identify tool name for context
     std::string tool = args[1];
-    run_in_wrapper(cmd_to_run, tool);
+    run_in_wrapper(cmd_to_run, tool, exe_dir);
     return 0;
   }
 
-  ensure_ollama_running();
+  // PLAN MODE: several commands, run as their dependencies allow
+  bool plan_mode = args[0] == "--plan";
+  if (plan_mode) {
+    args.erase(args.begin());
+    if (args.empty()) {
+      std::cerr << "Usage: ai --plan <request>\n";
+      return 1;
+    }
+  }
+
+  OllamaReadiness ollama;
   AiContext ctx;
   if (!cm.load_context(ctx)) {
+    ollama.ensure_running();
     setup_context(cm);
     return 0; // Return after setup, don't continue execution
   }
 
   std::string user_request = join(args, " ");
+  // The command most likely runs in PowerShell; start it now, while the
+  // command is generated and confirmed
+  if (!plan_mode)
+    prestart_shell_host();
 
   // COMMAND CACHE CHECK
   // Use JSONL for scalability as requested
@@ -554,6 +1109,23 @@ int main(int argc, char *argv[]) {
     cached_cmd = cache.find_cached_command(user_request, ctx.env_block);
   }
 
+  // Backends to generate with: the local Ollama unless backends.json lists
+  // others
+  llm::Router router(exe_dir, ctx.model_name);
+  router.set_hedge_percentile(hedge_percentile());
+
+  // Constant request prefix (model, options, system prompt) shared by the
+  // generation request and the auto-fix request
+  json::ChatRequestWriter request_writer;
+  request_writer.set_model(ctx.model_name);
+  request_writer.set_stream(true);
+  request_writer.set_keep_alive(ctx.keep_alive);
+  request_writer.set_generation_options(COMMAND_NUM_PREDICT, COMMAND_STOP);
+  request_writer.set_system_prompt(load_system_prompt(exe_dir, ctx.env_block));
+  if (plan_mode)
+    return run_plan_request(user_request, ctx, cm, router, request_writer,
+                            ollama);
+
   std::string command;
   bool from_cache = false;
 
@@ -563,9 +1135,12 @@ int main(int argc, char *argv[]) {
     from_cache = true;
     std::cout << CYAN << "[Cache Hit] " << RESET;
   } else {
-    // Not in cache, generate with AI
-    // Load External Prompt
-    std::string system_prompt = load_system_prompt(exe_dir, ctx.env_block);
+    // Not in cache, generate with AI. The model loads while the prompt is
+    // assembled below.
+    if (uses_local_ollama(router)) {
+      ollama.ensure_running();
+      start_model_warm_up(ctx);
+    }
 
     // MEMORY RETRIEVAL
     std::string mem_context = mem.retrieve_relevant_context(user_request, "");
@@ -574,22 +1149,46 @@ int main(int argc, char *argv[]) {
     std::string cache_context =
         cache.get_similar_commands(user_request); // Using robust search
 
-    json::Builder chat_builder;
-    chat_builder.add("model", ctx.model_name);
-    chat_builder.add("stream", false);
+    // PROMPT LAYOUT
+    // The system message carries only the static prompt + env block so it is
+    // byte-identical across runs and Ollama can reuse the KV cache for it
+    // (and for the unchanged part of the history that follows). Everything
+    // that changes per request goes after the history, right before the
+    // user turn.
+    request_writer.begin();
 
-    // Inject memory into system prompt for better adherence
+    // Limit transcript to last 5 exchanges
+    std::string_view limited_transcript = ctx.transcript;
+    size_t count = 0;
+    size_t pos = limited_transcript.length();
+    while (pos > 0 && count < 10) {
+      pos = limited_transcript.rfind("|||", pos - 1);
+      if (pos != std::string_view::npos)
+        count++;
+      else
+        break;
+    }
+    if (pos != std::string_view::npos && pos > 0) {
+      limited_transcript = limited_transcript.substr(pos);
+    }
+
+    load_history_into_request(request_writer, limited_transcript);
+
+    std::string dynamic_context;
+    // Memory of past failures for better adherence
     if (!mem_context.empty()) {
-      system_prompt += "\n\n" + mem_context;
-      system_prompt +=
+      dynamic_context += mem_context;
+      dynamic_context +=
           "\nCRITICAL: If the user request matches a past failure case above, "
           "you MUST propose a DIFFERENT command. Do not repeat mistakes.";
     }
 
-    // Inject cache context for similar successful commands
+    // Cache context for similar successful commands
     if (!cache_context.empty()) {
-      system_prompt += "\n\n" + cache_context;
-      system_prompt +=
+      if (!dynamic_context.empty())
+        dynamic_context += "\n\n";
+      dynamic_context += cache_context;
+      dynamic_context +=
           "\nINSTRUCTION: The above cached commands are PROVEN solutions for "
           "similar tasks. "
           "If the user request is analogous (e.g., opening a different app), "
@@ -599,40 +1198,42 @@ int main(int argc, char *argv[]) {
           "Do not reinvent the wheel if a robust pattern exists.";
     }
 
-    chat_builder.add_message("system", system_prompt);
-
-    // Limit transcript to last 5 exchanges
-    std::string limited_transcript = ctx.transcript;
-    size_t count = 0;
-    size_t pos = limited_transcript.length();
-    while (pos > 0 && count < 10) {
-      pos = limited_transcript.rfind("|||", pos - 1);
-      if (pos != std::string::npos)
-        count++;
-      else
-        break;
-    }
-    if (pos != std::string::npos && pos > 0) {
-      limited_transcript = limited_transcript.substr(pos);
-    }
-
-    load_history_into_builder(chat_builder, limited_transcript);
-    chat_builder.add_message("user", user_request);
+    if (!dynamic_context.empty())
+      request_writer.add_message("system", dynamic_context);
+    request_writer.add_message("user", user_request);
 
     std::cout << GRAY << "Thinking...\r" << RESET;
     std::flush(std::cout);
-    http::Client client("localhost", 11434);
-    http::Response resp = client.post("/api/chat", chat_builder.build());
 
-    // Clear "Thinking..." line
-    std::cout << "\r\033[K";
+    // STREAMING: show the command as it is generated. The preview is drawn
+    // after a saved cursor position and wiped once the final (cleaned up)
+    // command is known. Reading stops once the command line is complete.
+    bool preview_started = false;
+    auto render_delta = [&](const std::string &delta) {
+      if (delta.empty())
+        return;
+      if (!preview_started) {
+        std::cout << "\r\033[K\0337" << GRAY << "> ";
+        preview_started = true;
+      }
+      for (char c : delta)
+        std::cout << (c == '\n' || c == '\r' ? ' ' : c);
+      std::flush(std::cout);
+    };
 
-    if (resp.status_code != 200) {
-      std::cerr << RED << "Error: Ollama returned HTTP " << resp.status_code
-                << RESET << "\n";
-      return 1;
-    }
-    command = json::extract_response_content(resp.body);
+    StreamedCommand streamed =
+        stream_single_line_command(router, request_writer, render_delta);
+
+    // Clear "Thinking..." line or the streamed preview
+    if (preview_started)
+      std::cout << RESET << "\0338\033[J";
+    else
+      std::cout << "\r\033[K";
+
+    if (int code = generation_failure_code(streamed))
+      return code;
+    log_model_timing("generation", streamed);
+    command = streamed.command;
 
     // Trim whitespace
     const char *ws = " \t\n\r\f\v";
@@ -667,14 +1268,20 @@ int main(int argc, char *argv[]) {
   std::getline(std::cin, ans);
 
   if (ans.empty() || ans == "y" || ans == "Y") {
-    // AUTO-DETECT INTERACTIVE
-    if (is_interactive_tool(command)) {
-      // ... (Interactive mode logic)
-      // For brevity, skipping full interactive wrapper re-implementation in
-      // this block assuming user wants the RETRY logic focused:
-    }
-
-    int ret = execute_command_safely(command, exe_dir + "terminal_stderr.log");
+    // Start on the fix as soon as the command's stderr shows it failed.
+    // Not while Ollama may still need starting: that would stall the
+    // command's output and print over it.
+    SpeculativeFix speculative_fix;
+    auto speculate = [&](const std::string &early_stderr) {
+      if (!uses_local_ollama(router) || ollama.running_now())
+        speculative_fix.start(command, early_stderr, user_request, router,
+                              request_writer);
+    };
+    ProcessRunner::Result run = {};
+    int ret = execute_command_safely(command, exe_dir + "terminal_stderr.log",
+                                     &run, speculate);
+    std::string first_command = command;
+    std::string worked_instead;
     std::cout << GRAY << "[DEBUG] Exit Code: " << ret << RESET << "\n";
 
     // Read stderr
@@ -702,24 +1309,39 @@ int main(int argc, char *argv[]) {
       cache.mark_command_failed(user_request, command, stderr_content,
                                 ctx.env_block);
 
-      // Attempt Fix
-      std::string system_prompt_base =
-          load_system_prompt(exe_dir, ctx.env_block);
-      std::string fixed_command =
-          attempt_auto_fix(command, stderr_content, user_request,
-                           ctx.model_name, system_prompt_base);
+      // Attempt Fix: the one started while the command ran, else a new one
+      // (a cached command may have run without Ollama so far)
+      std::string fixed_command;
+      if (speculative_fix.started()) {
+        std::cout << YELLOW
+                  << "[Auto-Retry] Using the fix prepared while the command "
+                     "ran..."
+                  << RESET << "\n";
+        StreamedCommand fix = speculative_fix.take();
+        log_model_timing("auto-fix, speculative", fix);
+        fixed_command = fix.command;
+      }
+      if (fixed_command.empty()) {
+        if (uses_local_ollama(router))
+          ollama.ensure_running();
+        fixed_command = attempt_auto_fix(command, stderr_content, user_request,
+                                         router, request_writer);
+      }
 
       if (!fixed_command.empty() && fixed_command != command) {
         std::cout << CYAN << "[Auto-Retry] Trying alternative: " << RESET
                   << fixed_command << "\n";
-        int ret2 = execute_command_safely(fixed_command,
-                                          exe_dir + "terminal_stderr.log");
+        ProcessRunner::Result run2 = {};
+        int ret2 = execute_command_safely(
+            fixed_command, exe_dir + "terminal_stderr.log", &run2);
+        log_command_run(mem, user_request, fixed_command, run2, "");
 
         if (ret2 == 0) {
           std::cout << GREEN << "[Auto-Retry] Success!" << RESET << "\n";
           // Cache the WORKING command
           cache.cache_command(user_request, fixed_command, ctx.env_block);
           command = fixed_command; // Update for history
+          worked_instead = fixed_command;
           ret = 0;
           stderr_content = ""; // Clear error for history
         } else {
@@ -737,6 +1359,7 @@ int main(int argc, char *argv[]) {
       }
     } else {
       // SUCCESS (First try)
+      speculative_fix.discard();
       if (!from_cache) {
         std::string cmd_to_cache =
             optimize_command_for_cache(command, stderr_content);
@@ -747,6 +1370,8 @@ int main(int argc, char *argv[]) {
       }
     }
 
+    log_command_run(mem, user_request, first_command, run, worked_instead);
+
     // Append History with Result
     std::string result_str = (ret == 0)
                                  ? "[SUCCESS]"
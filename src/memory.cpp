@@ -54,7 +54,13 @@ void MemoryManager::log_execution(const MemoryEntry &entry) {
   json_line << "\"error_signature\":\"" << escape(entry.error_signature)
             << "\",";
   json_line << "\"summary\":\"" << escape(entry.summary) << "\",";
-  json_line << "\"fix\":\"" << escape(entry.fix) << "\"";
+  json_line << "\"fix\":\"" << escape(entry.fix) << "\",";
+  json_line << "\"wall_ms\":" << (long long)entry.wall_ms << ",";
+  json_line << "\"user_cpu_ms\":" << (long long)entry.user_cpu_ms << ",";
+  json_line << "\"sys_cpu_ms\":" << (long long)entry.sys_cpu_ms << ",";
+  json_line << "\"peak_rss_kb\":" << entry.peak_rss_kb << ",";
+  json_line << "\"stdout_bytes\":" << entry.stdout_bytes << ",";
+  json_line << "\"stderr_bytes\":" << entry.stderr_bytes;
   json_line << "}\n";
 
   std::ofstream file(filepath, std::ios::app);
@@ -16,6 +16,13 @@ struct MemoryEntry {
   std::string error_signature;
   std::string summary;
   std::string fix;
+  // What running the command cost (see ProcessRunner::Usage)
+  double wall_ms = 0;
+  double user_cpu_ms = 0;
+  double sys_cpu_ms = 0;
+  unsigned long long peak_rss_kb = 0;
+  unsigned long long stdout_bytes = 0;
+  unsigned long long stderr_bytes = 0;
 };
 
 class MemoryManager {
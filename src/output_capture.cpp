@@ -0,0 +1,137 @@
+#include "output_capture.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+const uint64_t FNV_PRIME = 1099511628211ULL;
+
+std::string temp_directory() {
+#ifdef _WIN32
+  char path[MAX_PATH + 1];
+  DWORD len = GetTempPathA(sizeof(path), path);
+  if (len > 0 && len < sizeof(path))
+    return std::string(path, len);
+  return ".\\";
+#else
+  const char *dir = std::getenv("TMPDIR");
+  std::string path = dir && *dir ? dir : "/tmp";
+  if (path.back() != '/')
+    path += '/';
+  return path;
+#endif
+}
+
+unsigned long current_pid() {
+#ifdef _WIN32
+  return GetCurrentProcessId();
+#else
+  return (unsigned long)getpid();
+#endif
+}
+
+} // namespace
+
+OutputCapture::OutputCapture(const CapturePolicy &policy,
+                             const char *spill_suffix)
+    : policy(policy), suffix(spill_suffix) {}
+
+OutputCapture::~OutputCapture() {
+  if (spill_file)
+    std::fclose(spill_file);
+}
+
+void OutputCapture::open_spill() {
+  static std::atomic<unsigned> counter{0};
+  spill_path = temp_directory() + "ai-shell-" + std::to_string(current_pid()) +
+               "-" + std::to_string(counter++) + suffix;
+  spill_file = std::fopen(spill_path.c_str(), "wb");
+  if (!spill_file)
+    spill_path.clear();
+}
+
+void OutputCapture::append(const char *data, size_t len) {
+  for (size_t i = 0; i < len; ++i)
+    hash = (hash ^ (unsigned char)data[i]) * FNV_PRIME;
+  total += len;
+
+  if (policy.spill) {
+    if (!spill_file && spill_path.empty())
+      open_spill();
+    if (spill_file)
+      std::fwrite(data, 1, len, spill_file);
+  }
+
+  size_t to_head = std::min(len, policy.head_bytes - head.size());
+  head.append(data, to_head);
+  data += to_head;
+  len -= to_head;
+  if (len == 0 || policy.tail_bytes == 0)
+    return;
+
+  // Only the last tail_bytes of this chunk can survive in the ring
+  if (len > policy.tail_bytes) {
+    data += len - policy.tail_bytes;
+    len = policy.tail_bytes;
+  }
+  if (ring.empty())
+    ring.reserve(policy.tail_bytes);
+  while (len > 0) {
+    if (ring.size() < policy.tail_bytes) {
+      size_t n = std::min(len, policy.tail_bytes - ring.size());
+      ring.append(data, n);
+      ring_pos = ring.size() % policy.tail_bytes;
+      data += n;
+      len -= n;
+      continue;
+    }
+    size_t n = std::min(len, policy.tail_bytes - ring_pos);
+    ring.replace(ring_pos, n, data, n);
+    ring_pos = (ring_pos + n) % policy.tail_bytes;
+    data += n;
+    len -= n;
+  }
+}
+
+std::string OutputCapture::text() const {
+  uint64_t omitted = total - head.size() - ring.size();
+  std::string out;
+  out.reserve(head.size() + ring.size() + 64);
+  out += head;
+  if (omitted > 0)
+    out += "\n... [" + std::to_string(omitted) + " bytes omitted] ...\n";
+  // Oldest tail byte sits at ring_pos once the ring has wrapped
+  if (ring.size() == policy.tail_bytes) {
+    out.append(ring, ring_pos, std::string::npos);
+    out.append(ring, 0, ring_pos);
+  } else {
+    out += ring;
+  }
+  return out;
+}
+
+CaptureInfo OutputCapture::finish() {
+  CaptureInfo info;
+  info.bytes = total;
+  info.truncated = total > head.size() + ring.size();
+  char digest[17];
+  std::snprintf(digest, sizeof(digest), "%016llx", (unsigned long long)hash);
+  info.digest = digest;
+
+  if (spill_file) {
+    std::fclose(spill_file);
+    spill_file = nullptr;
+    if (info.truncated)
+      info.spill_path = spill_path;
+    else
+      std::remove(spill_path.c_str()); // everything is in text() anyway
+  }
+  return info;
+}
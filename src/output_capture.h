@@ -0,0 +1,57 @@
+#ifndef OUTPUT_CAPTURE_H
+#define OUTPUT_CAPTURE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// How much of one output stream of a command is kept. The first head_bytes
+// and the last tail_bytes stay in memory; whatever lies between is only
+// counted (and written to the spill file if enabled).
+struct CapturePolicy {
+  size_t head_bytes = 32 * 1024;
+  size_t tail_bytes = 32 * 1024;
+  // Keep the complete stream in a temp file when it does not fit in memory
+  bool spill = false;
+};
+
+// What is known about a whole stream, even if only part of it was kept
+struct CaptureInfo {
+  uint64_t bytes = 0;
+  bool truncated = false; // the captured text omits part of the stream
+  std::string digest;     // FNV-1a 64 of the complete stream, hex
+  std::string spill_path; // complete stream, if spilled and truncated
+};
+
+// Bounded capture of one stream: head buffer, then a ring buffer for the
+// tail, an incremental digest and an optional spill file
+class OutputCapture {
+public:
+  explicit OutputCapture(const CapturePolicy &policy = CapturePolicy(),
+                         const char *spill_suffix = ".out");
+  ~OutputCapture();
+  OutputCapture(const OutputCapture &) = delete;
+  OutputCapture &operator=(const OutputCapture &) = delete;
+
+  void append(const char *data, size_t len);
+
+  // Head, a marker with the number of omitted bytes, tail
+  std::string text() const;
+  // Closes the spill file (removed again if nothing was omitted)
+  CaptureInfo finish();
+
+private:
+  CapturePolicy policy;
+  std::string head;
+  std::string ring; // tail_bytes long once anything passed the head
+  size_t ring_pos = 0;
+  uint64_t total = 0;
+  uint64_t hash = 14695981039346656037ULL;
+  const char *suffix;
+  FILE *spill_file = nullptr;
+  std::string spill_path;
+
+  void open_spill();
+};
+
+#endif // OUTPUT_CAPTURE_H
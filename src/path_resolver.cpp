@@ -0,0 +1,230 @@
+#include "path_resolver.h"
+#include "context_manager.h"
+#include "json_utils.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef _WIN32
+const char PATH_SEPARATOR = ';';
+const char DIR_SEPARATOR = '\\';
+#else
+const char PATH_SEPARATOR = ':';
+const char DIR_SEPARATOR = '/';
+#endif
+
+std::string read_file(const std::string &path) {
+  std::ifstream t(path, std::ios::binary);
+  if (!t)
+    return "";
+  std::stringstream buffer;
+  buffer << t.rdbuf();
+  return buffer.str();
+}
+
+std::vector<std::string> split(const std::string &value, char separator) {
+  std::vector<std::string> parts;
+  std::stringstream stream(value);
+  std::string part;
+  while (std::getline(stream, part, separator))
+    parts.push_back(part);
+  if (!value.empty() && value.back() == separator)
+    parts.push_back(""); // a trailing empty entry (on POSIX, ".")
+  return parts;
+}
+
+bool is_absolute(const std::string &dir) {
+#ifdef _WIN32
+  return (dir.size() >= 3 && dir[1] == ':' &&
+          (dir[2] == '\\' || dir[2] == '/')) ||
+         dir.compare(0, 2, "\\\\") == 0;
+#else
+  return !dir.empty() && dir[0] == '/';
+#endif
+}
+
+// -1 for a directory that does not exist (yet)
+long long modification_time(const std::string &dir) {
+  struct stat st;
+  return stat(dir.c_str(), &st) == 0 ? (long long)st.st_mtime : -1;
+}
+
+#ifdef _WIN32
+// Windows file names compare case-insensitively
+std::string lowercase(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+  return s;
+}
+
+// The PE optional header's Subsystem field says whether the program is a
+// console or a GUI program
+bool is_gui_program(const std::string &path) {
+  std::ifstream f(path, std::ios::binary);
+  unsigned char dos[64];
+  if (!f.read((char *)dos, sizeof(dos)) || dos[0] != 'M' || dos[1] != 'Z')
+    return false;
+  uint32_t pe_offset = dos[0x3C] | dos[0x3D] << 8 | dos[0x3E] << 16 |
+                       (uint32_t)dos[0x3F] << 24;
+  // "PE\0\0", the 20 byte file header, then Subsystem at offset 68 of the
+  // optional header (PE32 and PE32+ alike)
+  unsigned char pe[4 + 20 + 70];
+  if (!f.seekg(pe_offset) || !f.read((char *)pe, sizeof(pe)) ||
+      pe[0] != 'P' || pe[1] != 'E' || pe[2] != 0 || pe[3] != 0)
+    return false;
+  const int IMAGE_SUBSYSTEM_WINDOWS_GUI = 2;
+  return (pe[24 + 68] | pe[24 + 69] << 8) == IMAGE_SUBSYSTEM_WINDOWS_GUI;
+}
+#endif
+
+} // namespace
+
+PathResolver::PathResolver(const std::string &cache_path)
+    : cache_path(cache_path) {}
+
+void PathResolver::load() {
+  loaded = true;
+  const char *path = std::getenv("PATH");
+  key = path ? path : "";
+  dirs = split(key, PATH_SEPARATOR);
+#ifdef _WIN32
+  const char *pathext = std::getenv("PATHEXT");
+  std::string exts = pathext ? pathext : ".COM;.EXE;.BAT;.CMD";
+  key += "|" + exts;
+  for (const std::string &ext : split(exts, ';')) {
+    if (!ext.empty())
+      extensions.push_back(lowercase(ext));
+  }
+  for (std::string &dir : dirs) {
+    dir.erase(std::remove(dir.begin(), dir.end(), '"'), dir.end());
+    if (!dir.empty() && (dir.back() == '\\' || dir.back() == '/'))
+      dir.pop_back();
+  }
+  // cmd skips empty entries (a trailing ';', or ";;"), which are common
+  dirs.erase(std::remove(dirs.begin(), dirs.end(), std::string()), dirs.end());
+#else
+  extensions = {""};
+#endif
+  for (const std::string &dir : dirs) {
+    if (!is_absolute(dir)) {
+      usable = false;
+      return;
+    }
+  }
+
+  std::vector<long long> mtimes;
+  for (const std::string &dir : dirs)
+    mtimes.push_back(modification_time(dir));
+  json_t j = json_t::parse(read_file(cache_path), nullptr, false);
+  if (!j.is_object() || j.value("key", "") != key ||
+      j.value("mtimes", json_t::array()) != json_t(mtimes))
+    return; // stale: start over
+  json_t cached = j.value("programs", json_t::object());
+  for (auto &entry : cached.items()) {
+    Program program;
+    program.path = entry.value().value("path", "");
+    program.gui = entry.value().value("gui", false);
+    if (!program.path.empty())
+      programs[entry.key()] = program;
+  }
+}
+
+void PathResolver::save() const {
+  std::vector<long long> mtimes;
+  for (const std::string &dir : dirs)
+    mtimes.push_back(modification_time(dir));
+  json_t j = {
+      {"key", key}, {"mtimes", mtimes}, {"programs", json_t::object()}};
+  for (const auto &entry : programs)
+    j["programs"][entry.first] = {{"path", entry.second.path},
+                                  {"gui", entry.second.gui}};
+  ContextManager::write_atomic(cache_path, j.dump(2));
+}
+
+bool PathResolver::resolve(const std::string &name, Program &program) {
+  if (!loaded)
+    load();
+  if (!usable || name.empty())
+    return false;
+#ifdef _WIN32
+  if (name.find_first_of("\\/:") != std::string::npos)
+    return find_in("", name, program) == Match::program;
+  // cmd looks in the current directory before PATH
+  Match here = find_in(".", name, program);
+  if (here != Match::none)
+    return here == Match::program;
+  std::string cache_key = lowercase(name);
+#else
+  if (name.find('/') != std::string::npos)
+    return find_in("", name, program) == Match::program;
+  const std::string &cache_key = name;
+#endif
+  auto cached = programs.find(cache_key);
+  if (cached != programs.end()) {
+    program = cached->second;
+    return true;
+  }
+  for (const std::string &dir : dirs) {
+    Match match = find_in(dir, name, program);
+    if (match == Match::none)
+      continue;
+    if (match == Match::other)
+      return false;
+    programs[cache_key] = program;
+    save();
+    return true;
+  }
+  return false;
+}
+
+// Looks for name in dir ("" when name is a path), trying each PATHEXT
+// extension on Windows unless name has one
+PathResolver::Match PathResolver::find_in(const std::string &dir,
+                                          const std::string &name,
+                                          Program &program) const {
+  std::string base = dir.empty() ? name : dir + DIR_SEPARATOR + name;
+  program = Program();
+#ifdef _WIN32
+  std::vector<std::string> candidates = extensions;
+  size_t dot = name.find_last_of('.');
+  if (dot != std::string::npos &&
+      name.find_first_of("\\/", dot) == std::string::npos) {
+    // Another extension (a document, python3.11) is left to cmd
+    std::string ext = lowercase(name.substr(dot));
+    if (std::find(extensions.begin(), extensions.end(), ext) ==
+        extensions.end())
+      return Match::other;
+    candidates = {""};
+  }
+  for (const std::string &ext : candidates) {
+    std::string file = base + ext;
+    DWORD attributes = GetFileAttributesA(file.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES ||
+        (attributes & FILE_ATTRIBUTE_DIRECTORY))
+      continue;
+    std::string found = lowercase(file.substr(file.find_last_of('.')));
+    if (found != ".exe" && found != ".com")
+      return Match::other; // .bat/.cmd and the like need cmd
+    program.path = file;
+    program.gui = is_gui_program(file);
+    return Match::program;
+  }
+  return Match::none;
+#else
+  struct stat st;
+  if (stat(base.c_str(), &st) != 0 || !S_ISREG(st.st_mode) ||
+      access(base.c_str(), X_OK) != 0)
+    return Match::none;
+  program.path = base;
+  return Match::program;
+#endif
+}
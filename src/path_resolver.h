@@ -0,0 +1,49 @@
+#ifndef PATH_RESOLVER_H
+#define PATH_RESOLVER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Finds the program a command name runs, searching PATH as cmd.exe or the
+// POSIX shell would. Found programs are kept in a file so that later runs
+// skip the search. The file is only trusted while PATH (and PATHEXT) is
+// unchanged and no PATH directory has a new modification time, which is
+// what adding or removing a program gives it.
+class PathResolver {
+public:
+  struct Program {
+    std::string path;
+    bool gui = false; // Windows GUI program: cmd /c does not wait for it
+  };
+
+  explicit PathResolver(const std::string &cache_path);
+
+  // false when name is not found, or is not a program that can be started
+  // directly (a .bat/.cmd script, a document opened by file association),
+  // or PATH has relative entries whose meaning depends on the directory
+  // (on POSIX an empty entry is one; Windows skips empty entries).
+  // The current directory comes first on Windows, as in cmd, and is never
+  // cached.
+  bool resolve(const std::string &name, Program &program);
+
+private:
+  std::string cache_path;
+  bool loaded = false;
+  bool usable = true;
+  std::string key; // PATH, plus PATHEXT on Windows
+  std::vector<std::string> dirs;
+  std::vector<std::string> extensions; // tried in order; {""} on POSIX
+  std::map<std::string, Program> programs;
+
+  // What a directory has under a name: nothing, a program, or something
+  // the shell would run another way (which also ends the search)
+  enum class Match { none, program, other };
+
+  void load();
+  void save() const;
+  Match find_in(const std::string &dir, const std::string &name,
+                Program &program) const;
+};
+
+#endif // PATH_RESOLVER_H
@@ -0,0 +1,313 @@
+#include "plan_executor.h"
+#include "command_processor.h"
+#include "json_utils.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+const char *const LABEL_COLORS[] = {"\033[36m", "\033[35m", "\033[34m",
+                                    "\033[33m", "\033[32m"};
+const char *const GRAY = "\033[90m";
+const char *const GREEN = "\033[32m";
+const char *const RED = "\033[31m";
+const char *const YELLOW = "\033[33m";
+const char *const RESET = "\033[0m";
+
+// Prints for all steps at once, whole lines only, each after its step's
+// label; the ids are padded to one width so that the output lines up
+class LabeledOutput {
+public:
+  explicit LabeledOutput(const std::vector<PlanStep> &steps) {
+    size_t width = 0;
+    for (const PlanStep &step : steps)
+      width = std::max(width, step.id.size());
+    for (size_t i = 0; i < steps.size(); ++i) {
+      labels.push_back(std::string(LABEL_COLORS[i % 5]) + "[" + steps[i].id +
+                       "]" + std::string(width - steps[i].id.size(), ' ') +
+                       RESET + " ");
+    }
+  }
+
+  void line(size_t step, const std::string &text, bool is_stderr = false) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostream &out = is_stderr ? std::cerr : std::cout;
+    out << labels[step] << text << "\n" << std::flush;
+  }
+
+private:
+  std::vector<std::string> labels;
+  std::mutex mutex;
+};
+
+// Cuts one step's output chunks into lines for LabeledOutput; what is left
+// without a newline at the end comes out in flush()
+class StepPrinter {
+public:
+  StepPrinter(LabeledOutput &output, size_t step)
+      : output(output), step(step) {}
+
+  void write(const char *data, size_t len, bool is_stderr) {
+    std::string &pending = is_stderr ? err : out;
+    pending.append(data, len);
+    size_t start = 0, eol;
+    while ((eol = pending.find('\n', start)) != std::string::npos) {
+      emit(pending.substr(start, eol - start), is_stderr);
+      start = eol + 1;
+    }
+    pending.erase(0, start);
+  }
+
+  void flush() {
+    if (!out.empty())
+      emit(out, false);
+    if (!err.empty())
+      emit(err, true);
+    out.clear();
+    err.clear();
+  }
+
+private:
+  LabeledOutput &output;
+  size_t step;
+  std::string out, err;
+
+  void emit(std::string text, bool is_stderr) {
+    if (!text.empty() && text.back() == '\r')
+      text.pop_back();
+    output.line(step, text, is_stderr);
+  }
+};
+
+std::string seconds(double ms) {
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.1f s", ms / 1000);
+  return buffer;
+}
+
+} // namespace
+
+size_t find_plan_end(const std::string &reply) {
+  size_t start = reply.find('{');
+  if (start == std::string::npos)
+    return std::string::npos;
+  int depth = 0;
+  bool in_string = false, escaped = false;
+  for (size_t i = start; i < reply.size(); ++i) {
+    char c = reply[i];
+    if (in_string) {
+      if (escaped)
+        escaped = false;
+      else if (c == '\\')
+        escaped = true;
+      else if (c == '"')
+        in_string = false;
+    } else if (c == '"') {
+      in_string = true;
+    } else if (c == '{') {
+      ++depth;
+    } else if (c == '}' && --depth == 0) {
+      return i + 1;
+    }
+  }
+  return std::string::npos;
+}
+
+bool parse_plan(const std::string &reply, std::vector<PlanStep> &steps,
+                std::string &error) {
+  steps.clear();
+  size_t end = find_plan_end(reply);
+  if (end == std::string::npos) {
+    error = "the reply has no complete JSON object";
+    return false;
+  }
+  size_t start = reply.find('{');
+  json_t j = json_t::parse(reply.substr(start, end - start), nullptr, false);
+  if (j.is_discarded() || !j.is_object() || !j.contains("steps") ||
+      !j["steps"].is_array()) {
+    error = "the reply is not a {\"steps\": [...]} object";
+    return false;
+  }
+  if (j["steps"].empty() || j["steps"].size() > PLAN_MAX_STEPS) {
+    error = "a plan needs 1 to " + std::to_string(PLAN_MAX_STEPS) + " steps";
+    return false;
+  }
+
+  std::map<std::string, size_t> index;
+  for (const json_t &s : j["steps"]) {
+    PlanStep step;
+    if (s.is_object()) {
+      step.id = s.value("id", "");
+      step.command = s.value("command", "");
+      json_t after = s.value("after", json_t::array());
+      for (const json_t &dep : after) {
+        if (dep.is_string())
+          step.after.push_back(dep.get<std::string>());
+      }
+    }
+    if (step.id.empty() || step.command.empty()) {
+      error = "every step needs an id and a command";
+      return false;
+    }
+    if (!index.emplace(step.id, steps.size()).second) {
+      error = "step id \"" + step.id + "\" is used twice";
+      return false;
+    }
+    steps.push_back(step);
+  }
+
+  // Every dependency must exist, and taking away the steps whose
+  // dependencies are all taken must eventually take every step (Kahn's
+  // algorithm); what is left is on a cycle
+  std::vector<size_t> waiting_on(steps.size());
+  std::vector<std::vector<size_t>> dependents(steps.size());
+  for (size_t i = 0; i < steps.size(); ++i) {
+    for (const std::string &dep : steps[i].after) {
+      auto found = index.find(dep);
+      if (found == index.end()) {
+        error = "step \"" + steps[i].id + "\" comes after unknown step \"" +
+                dep + "\"";
+        return false;
+      }
+      dependents[found->second].push_back(i);
+      ++waiting_on[i];
+    }
+  }
+  std::vector<size_t> free;
+  for (size_t i = 0; i < steps.size(); ++i) {
+    if (waiting_on[i] == 0)
+      free.push_back(i);
+  }
+  size_t taken = 0;
+  while (!free.empty()) {
+    size_t i = free.back();
+    free.pop_back();
+    ++taken;
+    for (size_t d : dependents[i]) {
+      if (--waiting_on[d] == 0)
+        free.push_back(d);
+    }
+  }
+  if (taken != steps.size()) {
+    error = "the steps depend on each other in a cycle";
+    return false;
+  }
+  return true;
+}
+
+int plan_jobs_from_env() {
+  const char *value = std::getenv("AI_SHELL_PLAN_JOBS");
+  int jobs = value ? std::atoi(value) : 0;
+  return jobs > 0 ? jobs : 4;
+}
+
+std::vector<StepOutcome> run_plan(const std::vector<PlanStep> &steps,
+                                  int max_parallel,
+                                  const ProcessRunner::Options &options) {
+  using Status = StepOutcome::Status;
+  enum class State { waiting, running, done };
+  std::vector<StepOutcome> outcomes(steps.size());
+  std::vector<State> states(steps.size(), State::waiting);
+  std::map<std::string, size_t> index;
+  for (size_t i = 0; i < steps.size(); ++i)
+    index[steps[i].id] = i;
+  if (max_parallel < 1)
+    max_parallel = 1;
+
+  LabeledOutput output(steps);
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<std::thread> threads;
+  int running = 0;
+  size_t done = 0;
+
+  auto run_step = [&](size_t i) {
+    StepPrinter printer(output, i);
+    ProcessRunner::Result result = ProcessRunner::run(
+        shell_command_line(sanitize_command(steps[i].command)),
+        [&](const char *data, size_t len, bool is_stderr) {
+          printer.write(data, len, is_stderr);
+        },
+        options);
+    printer.flush();
+
+    std::string stopped = termination_message(result, options);
+    bool ok = result.exit_code == 0 && stopped.empty();
+    if (ok) {
+      output.line(i, std::string(GREEN) + "done in " +
+                         seconds(result.usage.wall_ms) + RESET);
+    } else {
+      output.line(i,
+                  std::string(RED) + "failed with exit code " +
+                      std::to_string(result.exit_code) +
+                      (stopped.empty() ? "" : ": " + stopped) + RESET,
+                  true);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    outcomes[i].status = ok ? Status::succeeded : Status::failed;
+    outcomes[i].result = std::move(result);
+    outcomes[i].stopped = stopped;
+    states[i] = State::done;
+    ++done;
+    --running;
+    changed.notify_all();
+  };
+
+  // Each pass skips the steps behind a failure and starts the ready ones
+  // while there is room; it waits for a running step to finish only when
+  // a pass changed nothing
+  std::unique_lock<std::mutex> lock(mutex);
+  while (done < steps.size()) {
+    bool progressed = false;
+    for (size_t i = 0; i < steps.size(); ++i) {
+      if (states[i] != State::waiting)
+        continue;
+      const std::string *blocked_by = nullptr;
+      bool ready = true;
+      for (const std::string &dep : steps[i].after) {
+        auto found = index.find(dep);
+        size_t d = found == index.end() ? i : found->second;
+        if (d != i && states[d] != State::done) {
+          ready = false;
+        } else if (d == i || outcomes[d].status != Status::succeeded) {
+          blocked_by = &dep;
+          break;
+        }
+      }
+      if (blocked_by) {
+        outcomes[i].status = Status::skipped;
+        outcomes[i].blocked_by = *blocked_by;
+        states[i] = State::done;
+        ++done;
+        progressed = true;
+        output.line(i, std::string(YELLOW) + "skipped: " + *blocked_by +
+                           " did not succeed" + RESET);
+      } else if (ready && running < max_parallel) {
+        states[i] = State::running;
+        ++running;
+        progressed = true;
+        output.line(i, std::string(GRAY) + "$ " + steps[i].command + RESET);
+        threads.emplace_back(run_step, i);
+      }
+    }
+    if (progressed)
+      continue;
+    if (running == 0) {
+      // Nothing runs and nothing can start: a cycle parse_plan would have
+      // refused. Leave the rest skipped.
+      break;
+    }
+    changed.wait(lock);
+  }
+  lock.unlock();
+  for (std::thread &thread : threads)
+    thread.join();
+  return outcomes;
+}
@@ -0,0 +1,53 @@
+#ifndef PLAN_EXECUTOR_H
+#define PLAN_EXECUTOR_H
+
+#include "process_runner.h"
+#include <string>
+#include <vector>
+
+// One command of a multi-step plan (ai --plan)
+struct PlanStep {
+  std::string id;
+  std::string command;
+  std::vector<std::string> after; // ids of the steps that must succeed first
+};
+
+// Most steps a plan may have
+const size_t PLAN_MAX_STEPS = 16;
+
+// Finds where the JSON object in a (possibly partial) model reply ends:
+// right after the brace that closes the first top-level object, so that
+// anything the model adds after it is never waited for. Returns
+// std::string::npos while the object is still incomplete.
+size_t find_plan_end(const std::string &reply);
+
+// Reads a plan from the model's reply, {"steps": [{"id": ..., "command":
+// ..., "after": [...]}, ...]}, possibly inside a code fence. false with
+// error set if it is not one, has no steps or more than PLAN_MAX_STEPS, or
+// has an empty or repeated id, an empty command, a dependency on an
+// unknown step, or a cycle.
+bool parse_plan(const std::string &reply, std::vector<PlanStep> &steps,
+                std::string &error);
+
+// How many steps run at once: AI_SHELL_PLAN_JOBS, 4 when unset
+int plan_jobs_from_env();
+
+struct StepOutcome {
+  enum class Status { succeeded, failed, skipped };
+  Status status = Status::skipped;
+  ProcessRunner::Result result; // only for steps that ran
+  std::string stopped;          // termination_message, if a limit hit
+  std::string blocked_by;       // the failed or skipped step, if skipped
+};
+
+// Runs a parsed plan: each step starts as soon as every step it comes
+// after has succeeded, with at most max_parallel running at once, each a
+// shell of its own through ProcessRunner with options. Output is printed
+// line by line as it arrives, each line labeled with the step's id. When a
+// step fails, the steps that depend on it (directly or not) are skipped;
+// the others still run. Returns the outcomes in the order of steps.
+std::vector<StepOutcome> run_plan(const std::vector<PlanStep> &steps,
+                                  int max_parallel,
+                                  const ProcessRunner::Options &options);
+
+#endif // PLAN_EXECUTOR_H
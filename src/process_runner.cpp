@@ -1,50 +1,483 @@
 #include "process_runner.h"
+#include "shell_host.h"
+
+#ifdef _WIN32
+
+#include <algorithm>
+#include <atomic>
 #include <chrono>
-#include <iostream>
-#include <thread>
+#include <memory>
+#include <string>
+#include <type_traits>
 #include <vector>
 #include <windows.h>
+#include <psapi.h>
 
+namespace {
 
-ProcessRunner::Result ProcessRunner::run(const std::string &command,
-                                         StreamCallback callback) {
-  Result result;
-  result.exit_code = -1;
+// Pipe buffer and read size: large enough that a chatty command is read in
+// few system calls
+const DWORD PIPE_BUFSIZE = 65536;
+// After the process exited, how long to wait for the rest of its output.
+// Normally the pipes report EOF at once; this only runs out when a
+// background grandchild inherited them and keeps them open.
+const DWORD DRAIN_GRACE_MS = 50;
+// On a pseudo console: how often the window size is compared, and how long
+// the output may take to end once the console is closed after the exit
+const DWORD RESIZE_POLL_MS = 100;
+const DWORD PTY_CLOSE_GRACE_MS = 1000;
+
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+#ifndef ENABLE_VIRTUAL_TERMINAL_INPUT
+#define ENABLE_VIRTUAL_TERMINAL_INPUT 0x0200
+#endif
+#ifndef PSEUDOCONSOLE_INHERIT_CURSOR
+#define PSEUDOCONSOLE_INHERIT_CURSOR 0x1
+#endif
+#ifndef PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE
+#define PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE 0x00020016
+#endif
+
+// Read end of a stdout/stderr pipe with one overlapped read in flight
+struct PipeReader {
+  HANDLE pipe = NULL;
+  HANDLE event = NULL;
+  OVERLAPPED overlapped;
+  bool is_stderr = false;
+  bool open = false;
+  OutputCapture *output = nullptr;
+  std::vector<char> buffer;
+
+  PipeReader() : buffer(PIPE_BUFSIZE) {}
+  ~PipeReader() { close(); }
+
+  void close() {
+    if (open) {
+      // Settle the pending read before its buffer goes away
+      DWORD n;
+      CancelIoEx(pipe, &overlapped);
+      GetOverlappedResult(pipe, &overlapped, &n, TRUE);
+      open = false;
+    }
+    if (pipe)
+      CloseHandle(pipe);
+    if (event)
+      CloseHandle(event);
+    pipe = event = NULL;
+  }
 
+  // Queues the next read; false once the writer side is gone
+  bool start_read() {
+    ZeroMemory(&overlapped, sizeof(overlapped));
+    overlapped.hEvent = event;
+    if (!ReadFile(pipe, buffer.data(), PIPE_BUFSIZE, NULL, &overlapped) &&
+        GetLastError() != ERROR_IO_PENDING) {
+      open = false;
+      return false;
+    }
+    open = true;
+    return true;
+  }
+
+  // Delivers a completed read and queues the next one
+  void complete(const ProcessRunner::StreamCallback &callback) {
+    DWORD n = 0;
+    if (!GetOverlappedResult(pipe, &overlapped, &n, FALSE)) {
+      open = false; // ERROR_BROKEN_PIPE: every writer closed its end
+      return;
+    }
+    if (n > 0) {
+      if (output)
+        output->append(buffer.data(), n);
+      if (callback)
+        callback(buffer.data(), n, is_stderr);
+    }
+    start_read();
+  }
+};
+
+// Unique name for a new pipe, without the \\.\pipe\ prefix
+std::string unique_pipe_name() {
+  static std::atomic<unsigned> counter{0};
+  return "ai-shell-" + std::to_string(GetCurrentProcessId()) + "-" +
+         std::to_string(counter++);
+}
+
+// Anonymous pipes cannot do overlapped I/O, so the read end is a uniquely
+// named pipe opened for overlapped reads. The write end is inheritable.
+bool create_output_pipe(PipeReader &reader, HANDLE &write_end) {
+  std::string name = "\\\\.\\pipe\\" + unique_pipe_name();
+  reader.pipe = CreateNamedPipeA(
+      name.c_str(),
+      PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+      PIPE_TYPE_BYTE | PIPE_WAIT, 1, 0, PIPE_BUFSIZE, 0, NULL);
+  if (reader.pipe == INVALID_HANDLE_VALUE) {
+    reader.pipe = NULL;
+    return false;
+  }
   SECURITY_ATTRIBUTES sa_attr;
   sa_attr.nLength = sizeof(SECURITY_ATTRIBUTES);
   sa_attr.bInheritHandle = TRUE;
   sa_attr.lpSecurityDescriptor = NULL;
+  write_end = CreateFileA(name.c_str(), GENERIC_WRITE, 0, &sa_attr,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (write_end == INVALID_HANDLE_VALUE) {
+    write_end = NULL;
+    return false;
+  }
+  reader.event = CreateEventA(NULL, TRUE, FALSE, NULL);
+  return reader.event != NULL;
+}
+
+// Gives si an attribute list, kept in buffer, holding one attribute.
+// Inheriting handles is limited to a HANDLE_LIST this way: otherwise a
+// child inherits every inheritable handle open at the time, including the
+// pipe ends of commands other threads are starting, and those pipes then
+// see no EOF until that child exits too.
+void set_startup_attribute(STARTUPINFOEXA &si, std::vector<char> &buffer,
+                           DWORD_PTR attribute, PVOID value, SIZE_T size) {
+  SIZE_T buffer_size = 0;
+  InitializeProcThreadAttributeList(NULL, 1, 0, &buffer_size);
+  buffer.resize(buffer_size);
+  si.lpAttributeList = (LPPROC_THREAD_ATTRIBUTE_LIST)buffer.data();
+  InitializeProcThreadAttributeList(si.lpAttributeList, 1, 0, &buffer_size);
+  UpdateProcThreadAttribute(si.lpAttributeList, 0, attribute, value, size,
+                            NULL, NULL);
+  si.StartupInfo.cb = sizeof(si);
+}
+
+// ConPTY (Windows 10 1809 and later), looked up at run time so that ai
+// still starts, without pty support, on older Windows
+typedef void *PseudoConsole;
+struct ConPty {
+  HRESULT(WINAPI *create)(COORD, HANDLE, HANDLE, DWORD, PseudoConsole *);
+  HRESULT(WINAPI *resize)(PseudoConsole, COORD);
+  void(WINAPI *close)(PseudoConsole);
+};
+
+const ConPty *conpty() {
+  static const ConPty *api = []() -> const ConPty * {
+    static ConPty found;
+    HMODULE kernel = GetModuleHandleA("kernel32.dll");
+    if (!kernel)
+      return nullptr;
+    auto load = [&](const char *name, auto &function) {
+      function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(
+          reinterpret_cast<void (*)()>(GetProcAddress(kernel, name)));
+      return function != nullptr;
+    };
+    if (load("CreatePseudoConsole", found.create) &&
+        load("ResizePseudoConsole", found.resize) &&
+        load("ClosePseudoConsole", found.close))
+      return &found;
+    return nullptr;
+  }();
+  return api;
+}
+
+// Visible size of this process's console window (80x25 without one)
+COORD console_size() {
+  CONSOLE_SCREEN_BUFFER_INFO info;
+  COORD size = {80, 25};
+  if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) {
+    size.X = info.srWindow.Right - info.srWindow.Left + 1;
+    size.Y = info.srWindow.Bottom - info.srWindow.Top + 1;
+  }
+  return size;
+}
+
+DWORD WINAPI close_pseudo_console(LPVOID console) {
+  conpty()->close((PseudoConsole)console);
+  return 0;
+}
+
+// This process's console while a command runs on a pseudo console: keys
+// are read as VT input as they are typed, with no echo, line editing or
+// Ctrl+C handling here (the pseudo console does all that), and the VT
+// output it produces renders
+struct RawConsole {
+  HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+  HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+  DWORD input_mode = 0, output_mode = 0;
+  bool input_set = false, output_set = false;
+
+  RawConsole() {
+    if (GetConsoleMode(input, &input_mode))
+      input_set = SetConsoleMode(input, ENABLE_VIRTUAL_TERMINAL_INPUT);
+    if (GetConsoleMode(output, &output_mode))
+      output_set = SetConsoleMode(
+          output, output_mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+  }
+  ~RawConsole() {
+    if (input_set)
+      SetConsoleMode(input, input_mode);
+    if (output_set)
+      SetConsoleMode(output, output_mode);
+  }
+
+  // Both ends are the console, which then answers the pseudo console's
+  // cursor position query through the input
+  bool is_console() const { return input_set && output_set; }
+};
+
+// Passes what is typed at this process's console, or arrives on its stdin,
+// to the pseudo console. Console reads block, so this has a thread of its
+// own, which waits for key presses before reading so that it can be
+// stopped.
+struct InputForwarder {
+  HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+  HANDLE target = NULL; // the pseudo console's input pipe, or the stdin pipe
+  bool console = false;
+  bool close_at_end = false; // close target once this process's input ends
+  const std::function<std::string(const std::string &)> *filter = nullptr;
+  HANDLE stop = NULL;
+  HANDLE thread = NULL;
+
+  bool start() {
+    stop = CreateEventA(NULL, TRUE, FALSE, NULL);
+    if (stop)
+      thread = CreateThread(NULL, 0, main, this, 0, NULL);
+    return thread != NULL;
+  }
+
+  void finish() {
+    if (thread) {
+      SetEvent(stop);
+      CancelSynchronousIo(thread); // a pipe or file read in progress
+      WaitForSingleObject(thread, INFINITE);
+      CloseHandle(thread);
+    }
+    if (stop)
+      CloseHandle(stop);
+    thread = stop = NULL;
+  }
+
+  static DWORD WINAPI main(LPVOID self) {
+    static_cast<InputForwarder *>(self)->forward();
+    return 0;
+  }
+
+  // Whether a key press that reads as text waits in the console input.
+  // Other records (key releases, focus, mouse, resizes) are dropped, or
+  // the input handle would stay signaled while a read blocked.
+  bool key_waiting() {
+    INPUT_RECORD record;
+    DWORD n = 0;
+    while (PeekConsoleInputA(input, &record, 1, &n) && n == 1) {
+      if (record.EventType == KEY_EVENT && record.Event.KeyEvent.bKeyDown &&
+          record.Event.KeyEvent.uChar.AsciiChar != 0)
+        return true;
+      ReadConsoleInputA(input, &record, 1, &n);
+    }
+    return false;
+  }
+
+  void forward() {
+    std::vector<char> buffer(4096);
+    while (WaitForSingleObject(stop, 0) != WAIT_OBJECT_0) {
+      if (console) {
+        HANDLE handles[2] = {stop, input};
+        if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) !=
+            WAIT_OBJECT_0 + 1)
+          return;
+        if (!key_waiting())
+          continue;
+      }
+      DWORD n = 0;
+      if (!ReadFile(input, buffer.data(), (DWORD)buffer.size(), &n, NULL) ||
+          n == 0) {
+        // End of input (a console read stopped by finish() is not one)
+        if (close_at_end && WaitForSingleObject(stop, 0) != WAIT_OBJECT_0) {
+          CloseHandle(target);
+          target = NULL;
+        }
+        return;
+      }
+      std::string typed(buffer.data(), n);
+      std::string send = *filter ? (*filter)(typed) : typed;
+      DWORD written = 0;
+      if (!send.empty() && !WriteFile(target, send.data(), (DWORD)send.size(),
+                                      &written, NULL))
+        return;
+    }
+  }
+};
+
+double filetime_ms(const FILETIME &t) {
+  ULARGE_INTEGER v;
+  v.LowPart = t.dwLowDateTime;
+  v.HighPart = t.dwHighDateTime;
+  return v.QuadPart / 10000.0; // 100 ns units
+}
+
+// Job object holding the command's process tree. While the command runs,
+// closing the job (also when this process dies) kills the tree.
+struct Job {
+  HANDLE handle = NULL;
+
+  ~Job() {
+    if (handle)
+      CloseHandle(handle);
+  }
 
-  HANDLE h_out_read = NULL;
+  bool create(const ProcessRunner::Options &options) {
+    handle = CreateJobObjectA(NULL, NULL);
+    if (!handle)
+      return false;
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION info;
+    ZeroMemory(&info, sizeof(info));
+    DWORD &flags = info.BasicLimitInformation.LimitFlags;
+    flags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+    if (options.cpu_limit_ms > 0) {
+      // The system terminates the whole job once this is used up
+      flags |= JOB_OBJECT_LIMIT_JOB_TIME;
+      info.BasicLimitInformation.PerJobUserTimeLimit.QuadPart =
+          (LONGLONG)options.cpu_limit_ms * 10000;
+    }
+    if (options.memory_limit_bytes > 0) {
+      flags |= JOB_OBJECT_LIMIT_JOB_MEMORY;
+      info.JobMemoryLimit = (SIZE_T)options.memory_limit_bytes;
+    }
+    return SetInformationJobObject(handle, JobObjectExtendedLimitInformation,
+                                   &info, sizeof(info));
+  }
+
+  // Lets programs the command started in the background (start notepad)
+  // outlive the job handle
+  void release() {
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION info;
+    ZeroMemory(&info, sizeof(info));
+    SetInformationJobObject(handle, JobObjectExtendedLimitInformation, &info,
+                            sizeof(info));
+  }
+};
+
+// Quotes arg so that the program's command line parsing (the C runtime's
+// rules) gives it back unchanged
+std::string quote_argument(const std::string &arg) {
+  if (!arg.empty() && arg.find_first_of(" \t\n\v\"") == std::string::npos)
+    return arg;
+  std::string quoted = "\"";
+  for (size_t i = 0;; ++i) {
+    size_t backslashes = 0;
+    while (i < arg.size() && arg[i] == '\\') {
+      ++backslashes;
+      ++i;
+    }
+    if (i == arg.size()) {
+      // Doubled, so the closing quote is not escaped
+      quoted.append(backslashes * 2, '\\');
+      break;
+    }
+    if (arg[i] == '"')
+      quoted.append(backslashes * 2 + 1, '\\');
+    else
+      quoted.append(backslashes, '\\');
+    quoted += arg[i];
+  }
+  quoted += '"';
+  return quoted;
+}
+
+// Starts command (with application as the program to run, or NULL to take
+// it from the command line) and collects its output: run() and
+// run_program()
+ProcessRunner::Result run_process(const char *application,
+                                  const std::string &command,
+                                  const ProcessRunner::StreamCallback &callback,
+                                  const ProcessRunner::Options &options) {
+  using Termination = ProcessRunner::Termination;
+  ProcessRunner::Result result;
+  result.exit_code = -1;
+
+  // On a pseudo console, out_reader reads what it renders and there is no
+  // stderr pipe. Without one, pty_input means the command reads a pipe fed
+  // with the lines typed here.
+  bool use_pty = options.pty && conpty();
+  bool piped_input = !use_pty && options.pty_input;
+  PipeReader out_reader, err_reader;
   HANDLE h_out_write = NULL;
-  HANDLE h_err_read = NULL;
   HANDLE h_err_write = NULL;
 
-  // Create pipes for stdout
-  if (!CreatePipe(&h_out_read, &h_out_write, &sa_attr, 0)) {
+  if (!create_output_pipe(out_reader, h_out_write)) {
+    if (h_out_write)
+      CloseHandle(h_out_write);
     result.stderr_output = "Failed to create stdout pipe.";
     return result;
   }
-  SetHandleInformation(h_out_read, HANDLE_FLAG_INHERIT,
-                       0); // Ensure read handle is NOT inherited
-
-  // Create pipes for stderr
-  if (!CreatePipe(&h_err_read, &h_err_write, &sa_attr, 0)) {
-    CloseHandle(h_out_read);
+  PseudoConsole console = NULL;
+  HANDLE h_in_read = NULL;
+  InputForwarder input;
+  std::unique_ptr<RawConsole> raw_console;
+  COORD size = console_size();
+  if (use_pty) {
+    // Inheriting the cursor position keeps it from drawing over what is
+    // already on screen
+    raw_console.reset(new RawConsole());
+    DWORD console_flags =
+        raw_console->is_console() ? PSEUDOCONSOLE_INHERIT_CURSOR : 0;
+    bool ok = CreatePipe(&h_in_read, &input.target, NULL, 0) &&
+              SUCCEEDED(conpty()->create(size, h_in_read, h_out_write,
+                                         console_flags, &console));
+    // The pseudo console has its own copies now
+    if (h_in_read)
+      CloseHandle(h_in_read);
     CloseHandle(h_out_write);
+    if (!ok) {
+      if (input.target)
+        CloseHandle(input.target);
+      result.stderr_output = "Failed to create a pseudo console.";
+      return result;
+    }
+  } else if (!create_output_pipe(err_reader, h_err_write)) {
+    CloseHandle(h_out_write);
+    if (h_err_write)
+      CloseHandle(h_err_write);
     result.stderr_output = "Failed to create stderr pipe.";
     return result;
+  } else if (piped_input) {
+    SECURITY_ATTRIBUTES sa_attr;
+    sa_attr.nLength = sizeof(SECURITY_ATTRIBUTES);
+    sa_attr.bInheritHandle = TRUE;
+    sa_attr.lpSecurityDescriptor = NULL;
+    if (!CreatePipe(&h_in_read, &input.target, &sa_attr, 0)) {
+      CloseHandle(h_out_write);
+      CloseHandle(h_err_write);
+      result.stderr_output = "Failed to create stdin pipe.";
+      return result;
+    }
+    SetHandleInformation(input.target, HANDLE_FLAG_INHERIT, 0);
+  }
+
+  Job job;
+  if (!job.create(options) && job.handle) {
+    CloseHandle(job.handle);
+    job.handle = NULL; // limits then rely on TerminateProcess
   }
-  SetHandleInformation(h_err_read, HANDLE_FLAG_INHERIT, 0);
 
-  STARTUPINFOA si;
+  auto start = std::chrono::steady_clock::now();
+  STARTUPINFOEXA si;
   PROCESS_INFORMATION pi;
   ZeroMemory(&si, sizeof(si));
-  si.cb = sizeof(si);
-  si.hStdError = h_err_write;
-  si.hStdOutput = h_out_write;
-  si.dwFlags |= STARTF_USESTDHANDLES;
+  si.StartupInfo.cb = sizeof(si.StartupInfo);
+  std::vector<char> attributes;
+  HANDLE inherited[3] = {h_out_write, h_err_write, h_in_read};
+  DWORD flags = CREATE_SUSPENDED | EXTENDED_STARTUPINFO_PRESENT;
+  if (use_pty) {
+    // The pseudo console is the child's console and its standard handles
+    set_startup_attribute(si, attributes, PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE,
+                          console, sizeof(console));
+  } else {
+    set_startup_attribute(si, attributes, PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+                          inherited,
+                          (piped_input ? 3 : 2) * sizeof(HANDLE));
+    si.StartupInfo.hStdError = h_err_write;
+    si.StartupInfo.hStdOutput = h_out_write;
+    si.StartupInfo.hStdInput = h_in_read;
+    si.StartupInfo.dwFlags |= STARTF_USESTDHANDLES;
+  }
 
   ZeroMemory(&pi, sizeof(pi));
 
@@ -52,110 +485,409 @@ ProcessRunner::Result ProcessRunner::run(const std::string &command,
   std::vector<char> cmd_buf(command.begin(), command.end());
   cmd_buf.push_back(0);
 
-  if (!CreateProcessA(NULL, cmd_buf.data(), NULL, NULL,
-                      TRUE, // Inherit handles
-                      0, NULL, NULL, &si, &pi)) {
-
-    CloseHandle(h_out_read);
-    CloseHandle(h_out_write);
-    CloseHandle(h_err_read);
-    CloseHandle(h_err_write);
+  // Suspended until it is in the job, so nothing it starts escapes
+  BOOL created = CreateProcessA(application, cmd_buf.data(), NULL, NULL,
+                                !use_pty, // Inherit the pipes' write ends
+                                flags, NULL, NULL, &si.StartupInfo, &pi);
+  DeleteProcThreadAttributeList(si.lpAttributeList);
+  if (!created) {
     result.stderr_output =
         "CreateProcess failed (" + std::to_string(GetLastError()) + ")";
+    if (use_pty) {
+      out_reader.close();
+      conpty()->close(console);
+      CloseHandle(input.target);
+    } else {
+      CloseHandle(h_out_write);
+      CloseHandle(h_err_write);
+      if (piped_input) {
+        CloseHandle(h_in_read);
+        CloseHandle(input.target);
+      }
+    }
     return result;
   }
 
-  // Close write ends in this process
-  CloseHandle(h_out_write);
-  CloseHandle(h_err_write);
+  if (job.handle && !AssignProcessToJobObject(job.handle, pi.hProcess)) {
+    CloseHandle(job.handle);
+    job.handle = NULL;
+  }
+  ResumeThread(pi.hThread);
 
-  // READ LOOP using PeekNamedPipe
-  const int BUFSIZE = 4096;
-  char buffer[BUFSIZE];
-  bool process_running = true;
+  // Close the child's ends in this process
+  if (!use_pty) {
+    CloseHandle(h_out_write);
+    CloseHandle(h_err_write);
+    if (piped_input)
+      CloseHandle(h_in_read);
+  }
+
+  auto kill_tree = [&](UINT exit_code) {
+    if (job.handle)
+      TerminateJobObject(job.handle, exit_code);
+    else
+      TerminateProcess(pi.hProcess, exit_code);
+  };
+  bool has_deadline = options.wall_limit_ms > 0;
+  auto deadline = start + std::chrono::milliseconds(options.wall_limit_ms);
+
+  OutputCapture out_capture(options.capture, ".stdout");
+  OutputCapture err_capture(options.capture, ".stderr");
+  out_reader.output = &out_capture;
+  err_reader.is_stderr = true;
+  err_reader.output = &err_capture;
+  out_reader.start_read();
+  if (!use_pty)
+    err_reader.start_read();
+
+  // Keys typed here, on their way to the pseudo console; or, in line mode,
+  // whole lines (a console in its usual mode hands them over line by line)
+  // on their way to the stdin pipe, which is closed at the end of input
+  HANDLE closer = NULL;
+  if (use_pty || piped_input) {
+    DWORD mode;
+    input.console = use_pty ? raw_console->input_set
+                            : GetConsoleMode(input.input, &mode) != 0;
+    input.close_at_end = piped_input;
+    input.filter = &options.pty_input;
+    input.start();
+  }
 
-  while (process_running) {
-    bool did_read = false;
-    DWORD bytes_read = 0;
-    DWORD bytes_avail = 0;
-
-    // Check stdout
-    if (PeekNamedPipe(h_out_read, NULL, 0, NULL, &bytes_avail, NULL) &&
-        bytes_avail > 0) {
-      if (ReadFile(h_out_read, buffer, BUFSIZE, &bytes_read, NULL) &&
-          bytes_read > 0) {
-        result.stdout_output.append(buffer, bytes_read);
-        if (callback)
-          callback(buffer, bytes_read, false);
-        did_read = true;
+  // Sleep until output arrives, the process exits or the wall limit runs
+  // out; callbacks run on this thread in the order the data arrived
+  bool process_running = true;
+  while (process_running || out_reader.open || err_reader.open) {
+    HANDLE handles[3];
+    PipeReader *readers[3] = {nullptr, nullptr, nullptr};
+    DWORD count = 0;
+    for (PipeReader *r : {&out_reader, &err_reader}) {
+      if (r->open) {
+        readers[count] = r;
+        handles[count++] = r->event;
       }
     }
+    if (process_running)
+      handles[count++] = pi.hProcess;
 
-    // Check stderr
-    if (PeekNamedPipe(h_err_read, NULL, 0, NULL, &bytes_avail, NULL) &&
-        bytes_avail > 0) {
-      if (ReadFile(h_err_read, buffer, BUFSIZE, &bytes_read, NULL) &&
-          bytes_read > 0) {
-        result.stderr_output.append(buffer, bytes_read);
-        if (callback)
-          callback(buffer, bytes_read, true);
-        did_read = true;
+    DWORD wait_ms = closer ? PTY_CLOSE_GRACE_MS : DRAIN_GRACE_MS;
+    if (process_running && !has_deadline) {
+      wait_ms = INFINITE;
+    } else if (process_running) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      deadline - std::chrono::steady_clock::now())
+                      .count();
+      wait_ms = left > 0 ? (DWORD)left : 0;
+    }
+    if (process_running && use_pty)
+      wait_ms = std::min(wait_ms, RESIZE_POLL_MS);
+    DWORD wait = WaitForMultipleObjects(count, handles, FALSE, wait_ms);
+    // Whatever ended the wait: a command that never stops writing never
+    // lets it time out
+    if (process_running) {
+      COORD now = use_pty ? console_size() : size;
+      if (now.X != size.X || now.Y != size.Y) {
+        size = now;
+        conpty()->resize(console, size);
       }
+      if (has_deadline && std::chrono::steady_clock::now() >= deadline) {
+        kill_tree(ProcessRunner::TIMEOUT_EXIT_CODE);
+        result.termination = Termination::wall_timeout;
+        has_deadline = false; // now just wait for the exit
+      }
+      if (wait == WAIT_TIMEOUT)
+        continue;
     }
-
-    // Check process status
-    DWORD exit_code = 0;
-    if (!GetExitCodeProcess(pi.hProcess, &exit_code)) {
+    if (wait == WAIT_TIMEOUT || wait == WAIT_FAILED)
+      break; // the destructors cancel reads still pending
+    DWORD index = wait - WAIT_OBJECT_0;
+    if (readers[index]) {
+      readers[index]->complete(callback);
+    } else {
       process_running = false;
+      // The pseudo console's output only ends once it is closed. Closing
+      // waits for that output to be read, so it happens on another thread.
+      if (use_pty)
+        closer = CreateThread(NULL, 0, close_pseudo_console, console, 0, NULL);
+    }
+  }
+
+  if (piped_input) {
+    input.finish();
+    if (input.target)
+      CloseHandle(input.target);
+  }
+  if (use_pty) {
+    input.finish();
+    CloseHandle(input.target);
+    out_reader.close();
+    if (closer) {
+      WaitForSingleObject(closer, INFINITE);
+      CloseHandle(closer);
     } else {
-      if (exit_code != STILL_ACTIVE) {
-        // Even if process exited, pipes might still have data
-        // Run one last check loop until pipes empty
-        // For simplicity, we just switch flag and let the loop run once more
-        // for data But strictly, we should peek until 0.
-
-        // Let's do a strict drain
-        while (true) {
-          bool drained_any = false;
-          if (PeekNamedPipe(h_out_read, NULL, 0, NULL, &bytes_avail, NULL) &&
-              bytes_avail > 0) {
-            if (ReadFile(h_out_read, buffer, BUFSIZE, &bytes_read, NULL) &&
-                bytes_read > 0) {
-              result.stdout_output.append(buffer, bytes_read);
-              if (callback)
-                callback(buffer, bytes_read, false);
-              drained_any = true;
-            }
-          }
-          if (PeekNamedPipe(h_err_read, NULL, 0, NULL, &bytes_avail, NULL) &&
-              bytes_avail > 0) {
-            if (ReadFile(h_err_read, buffer, BUFSIZE, &bytes_read, NULL) &&
-                bytes_read > 0) {
-              result.stderr_output.append(buffer, bytes_read);
-              if (callback)
-                callback(buffer, bytes_read, true);
-              drained_any = true;
-            }
-          }
-          if (!drained_any)
-            break;
-        }
+      conpty()->close(console);
+    }
+    raw_console.reset();
+  }
 
-        result.exit_code = (int)exit_code;
-        process_running = false;
-      }
+  result.stdout_output = out_capture.text();
+  result.stdout_info = out_capture.finish();
+  result.stderr_output = err_capture.text();
+  result.stderr_info = err_capture.finish();
+
+  WaitForSingleObject(pi.hProcess, INFINITE);
+  DWORD exit_code = 0;
+  if (GetExitCodeProcess(pi.hProcess, &exit_code))
+    result.exit_code = (int)exit_code;
+
+  result.usage.wall_ms = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  FILETIME creation, exit, kernel, user;
+  if (GetProcessTimes(pi.hProcess, &creation, &exit, &kernel, &user)) {
+    result.usage.user_cpu_ms = filetime_ms(user);
+    result.usage.sys_cpu_ms = filetime_ms(kernel);
+  }
+  // Without a job, only the process at the root can be measured
+  PROCESS_MEMORY_COUNTERS memory;
+  if (GetProcessMemoryInfo(pi.hProcess, &memory, sizeof(memory)))
+    result.usage.peak_rss_bytes = memory.PeakWorkingSetSize;
+
+  if (job.handle) {
+    // CPU time of the whole tree, not just the cmd.exe/powershell at its root
+    JOBOBJECT_BASIC_ACCOUNTING_INFORMATION accounting;
+    if (QueryInformationJobObject(job.handle,
+                                  JobObjectBasicAccountingInformation,
+                                  &accounting, sizeof(accounting), NULL)) {
+      result.usage.user_cpu_ms = accounting.TotalUserTime.QuadPart / 10000.0;
+      result.usage.sys_cpu_ms = accounting.TotalKernelTime.QuadPart / 10000.0;
     }
+    // Likewise the largest process in the tree, not the interpreter
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+    bool have_limits = QueryInformationJobObject(
+        job.handle, JobObjectExtendedLimitInformation, &limits,
+        sizeof(limits), NULL);
+    if (have_limits)
+      result.usage.peak_rss_bytes = limits.PeakProcessMemoryUsed;
 
-    if (process_running && !did_read) {
-      // Avoid CPU spin
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (result.termination == Termination::exited) {
+      if (options.cpu_limit_ms > 0 &&
+          result.usage.user_cpu_ms >= options.cpu_limit_ms) {
+        result.termination = Termination::cpu_timeout;
+      } else if (options.memory_limit_bytes > 0 && result.exit_code != 0 &&
+                 have_limits &&
+                 limits.PeakJobMemoryUsed >=
+                     options.memory_limit_bytes / 10 * 9) {
+        // The job limit makes allocations fail rather than killing; a
+        // failure close to the limit is taken as hitting it
+        result.termination = Termination::memory_limit;
+      }
     }
+    job.release();
   }
+  if (result.termination == Termination::wall_timeout ||
+      result.termination == Termination::cpu_timeout)
+    result.exit_code = ProcessRunner::TIMEOUT_EXIT_CODE;
 
   CloseHandle(pi.hProcess);
   CloseHandle(pi.hThread);
-  CloseHandle(h_out_read);
-  CloseHandle(h_err_read);
 
   return result;
 }
+
+} // namespace
+
+ProcessRunner::Result ProcessRunner::run(const std::string &command,
+                                         StreamCallback callback,
+                                         const Options &options) {
+  return run_process(NULL, command, callback, options);
+}
+
+bool ProcessRunner::pty_supported() { return conpty() != nullptr; }
+
+ProcessRunner::Result
+ProcessRunner::run_program(const std::string &program,
+                           const std::vector<std::string> &args,
+                           StreamCallback callback, const Options &options) {
+  std::string command_line;
+  for (const std::string &arg : args) {
+    if (!command_line.empty())
+      command_line += ' ';
+    command_line += quote_argument(arg);
+  }
+  return run_process(program.c_str(), command_line, callback, options);
+}
+
+// ShellHost transport: powershell reading commands from a named pipe it
+// connects to, so that its stdin stays empty like that of other commands
+
+struct ShellHost::Impl {
+  PROCESS_INFORMATION pi;
+  HANDLE channel = NULL;
+  HANDLE event = NULL; // for the connect, then for writes
+  OVERLAPPED connect;
+  bool connected = false;
+  bool running = true;
+  PipeReader out_reader, err_reader;
+
+  Impl() {
+    ZeroMemory(&pi, sizeof(pi));
+    ZeroMemory(&connect, sizeof(connect));
+  }
+  ~Impl() {
+    if (channel) {
+      if (!connected) {
+        DWORD n;
+        CancelIoEx(channel, &connect);
+        GetOverlappedResult(channel, &connect, &n, TRUE);
+      }
+      CloseHandle(channel);
+    }
+    if (event)
+      CloseHandle(event);
+    if (pi.hProcess)
+      CloseHandle(pi.hProcess);
+    if (pi.hThread)
+      CloseHandle(pi.hThread);
+  }
+};
+
+ShellHost::ShellHost(Kind kind) : kind(kind) {}
+
+// Closing the channel ends the host's read loop once the command it is
+// running (if any) returns
+ShellHost::~ShellHost() {}
+
+void ShellHost::stop() { impl.reset(); }
+
+bool ShellHost::launch() {
+  if (kind != Kind::powershell)
+    return false;
+  std::unique_ptr<Impl> host(new Impl());
+  HANDLE h_out_write = NULL;
+  HANDLE h_err_write = NULL;
+  std::string channel = unique_pipe_name();
+  bool ok = create_output_pipe(host->out_reader, h_out_write) &&
+            create_output_pipe(host->err_reader, h_err_write);
+  if (ok) {
+    host->channel = CreateNamedPipeA(
+        ("\\\\.\\pipe\\" + channel).c_str(),
+        PIPE_ACCESS_OUTBOUND | FILE_FLAG_OVERLAPPED |
+            FILE_FLAG_FIRST_PIPE_INSTANCE,
+        PIPE_TYPE_BYTE | PIPE_WAIT, 1, PIPE_BUFSIZE, 0, 0, NULL);
+    if (host->channel == INVALID_HANDLE_VALUE)
+      host->channel = NULL;
+    host->event = CreateEventA(NULL, TRUE, FALSE, NULL);
+    ok = host->channel && host->event;
+  }
+  if (ok) {
+    // Completes once PowerShell has started up and connected
+    host->connect.hEvent = host->event;
+    if (!ConnectNamedPipe(host->channel, &host->connect)) {
+      DWORD error = GetLastError();
+      if (error == ERROR_PIPE_CONNECTED)
+        host->connected = true;
+      else if (error != ERROR_IO_PENDING)
+        ok = false;
+    }
+  }
+  if (ok) {
+    STARTUPINFOEXA si;
+    ZeroMemory(&si, sizeof(si));
+    std::vector<char> attributes;
+    HANDLE inherited[2] = {h_out_write, h_err_write};
+    set_startup_attribute(si, attributes, PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+                          inherited, sizeof(inherited));
+    si.StartupInfo.hStdError = h_err_write;
+    si.StartupInfo.hStdOutput = h_out_write;
+    si.StartupInfo.dwFlags |= STARTF_USESTDHANDLES;
+    std::string command = startup_command(channel);
+    std::vector<char> cmd_buf(command.begin(), command.end());
+    cmd_buf.push_back(0);
+    ok = CreateProcessA(NULL, cmd_buf.data(), NULL, NULL, TRUE,
+                        EXTENDED_STARTUPINFO_PRESENT, NULL, NULL,
+                        &si.StartupInfo, &host->pi);
+    DeleteProcThreadAttributeList(si.lpAttributeList);
+  }
+  if (h_out_write)
+    CloseHandle(h_out_write);
+  if (h_err_write)
+    CloseHandle(h_err_write);
+  if (!ok)
+    return false;
+
+  host->err_reader.is_stderr = true;
+  host->out_reader.start_read();
+  host->err_reader.start_read();
+  impl = std::move(host);
+  return true;
+}
+
+bool ShellHost::send(const std::string &message) {
+  if (!impl || !impl->running)
+    return false;
+  Impl &host = *impl;
+  if (!host.connected) {
+    HANDLE handles[2] = {host.event, host.pi.hProcess};
+    DWORD n;
+    if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0 ||
+        !GetOverlappedResult(host.channel, &host.connect, &n, FALSE))
+      return false; // exited before it connected
+    host.connected = true;
+  }
+  if (WaitForSingleObject(host.pi.hProcess, 0) == WAIT_OBJECT_0) {
+    host.running = false;
+    return false;
+  }
+  OVERLAPPED write;
+  ZeroMemory(&write, sizeof(write));
+  ResetEvent(host.event);
+  write.hEvent = host.event;
+  DWORD n = 0;
+  if (!WriteFile(host.channel, message.data(), (DWORD)message.size(), NULL,
+                 &write) &&
+      GetLastError() != ERROR_IO_PENDING)
+    return false;
+  return GetOverlappedResult(host.channel, &write, &n, TRUE) &&
+         n == message.size();
+}
+
+bool ShellHost::pump(const ProcessRunner::StreamCallback &on_output) {
+  Impl &host = *impl;
+  while (true) {
+    HANDLE handles[3];
+    PipeReader *readers[3] = {nullptr, nullptr, nullptr};
+    DWORD count = 0;
+    for (PipeReader *r : {&host.out_reader, &host.err_reader}) {
+      if (r->open) {
+        readers[count] = r;
+        handles[count++] = r->event;
+      }
+    }
+    if (host.running)
+      handles[count++] = host.pi.hProcess;
+    if (count == 0)
+      return false;
+
+    DWORD wait = WaitForMultipleObjects(count, handles, FALSE,
+                                        host.running ? INFINITE
+                                                     : DRAIN_GRACE_MS);
+    if (wait == WAIT_TIMEOUT || wait == WAIT_FAILED)
+      return false;
+    DWORD index = wait - WAIT_OBJECT_0;
+    if (readers[index]) {
+      readers[index]->complete(on_output);
+      return true;
+    }
+    host.running = false; // drain what it wrote before exiting
+  }
+}
+
+int ShellHost::exit_code() {
+  WaitForSingleObject(impl->pi.hProcess, INFINITE);
+  DWORD exit_code = 0;
+  if (!GetExitCodeProcess(impl->pi.hProcess, &exit_code))
+    return -1;
+  return (int)exit_code;
+}
+
+#endif // _WIN32
@@ -1,28 +1,116 @@
 #ifndef PROCESS_RUNNER_H
 #define PROCESS_RUNNER_H
 
+#include "output_capture.h"
+#include <cstdint>
 #include <functional>
 #include <string>
+#include <utility>
+#include <vector>
 
 
-// A robust process runner for Windows using Native API
-// Captures default output and error streams
+// Runs a command line with its stdout and stderr captured: CreateProcess on
+// Windows (process_runner.cpp), posix_spawn of /bin/sh -c elsewhere
+// (process_runner_posix.cpp)
 class ProcessRunner {
 public:
+  // What running the command cost. CPU time and peak memory cover the
+  // process and the children it waited for; on Windows, every process in
+  // the command's job.
+  struct Usage {
+    double wall_ms = 0;
+    double user_cpu_ms = 0;
+    double sys_cpu_ms = 0;
+    // Of the largest process; on Windows its peak committed memory (the
+    // root's peak working set if the job could not be created)
+    uint64_t peak_rss_bytes = 0;
+  };
+
+  // Why the command stopped
+  enum class Termination {
+    exited,       // on its own (any exit code)
+    wall_timeout, // Options::wall_limit_ms ran out; the tree was killed
+    cpu_timeout,  // Options::cpu_limit_ms ran out; the tree was killed
+    memory_limit, // killed or failed for hitting Options::memory_limit_bytes
+  };
+
+  // Exit code reported for wall and CPU timeouts, as timeout(1) does
+  static const int TIMEOUT_EXIT_CODE = 124;
+
   struct Result {
     int exit_code;
+    // Bounded by the capture policy; the *_info fields describe the whole
+    // streams
     std::string stdout_output;
     std::string stderr_output;
+    CaptureInfo stdout_info;
+    CaptureInfo stderr_info;
+    Usage usage;
+    Termination termination = Termination::exited;
   };
 
-  // Callback type for streaming output: data, length, is_stderr
+  // The command and everything it starts run as one unit, so a limit stops
+  // the whole tree: a job object on Windows; on POSIX, when a limit is set,
+  // a process group (which then cannot read the terminal) plus a cgroup v2
+  // where one is delegated to this process. If this process is killed
+  // mid-run, the command is stopped too. Background programs left behind by
+  // a command that exited on its own keep running. Limits of 0 mean none.
+  //
+  // With pty, the command runs on a pseudo-terminal instead of pipes
+  // (ConPTY on Windows, a new session with the pty as its controlling
+  // terminal elsewhere), so it line-buffers and prompts as it would in a
+  // terminal. Everything it writes then arrives as stdout, escape sequences
+  // included, and stderr_output stays empty. What is typed at this
+  // process's terminal goes to the command key by key, through pty_input
+  // if set (which returns what to send instead; called on the thread that
+  // called run(), or a thread of its own on Windows). The pty's size
+  // follows this process's window. The callback is expected to show the
+  // output on this process's terminal, which answers the cursor position
+  // query ConPTY starts with.
+  //
+  // Without a pty (not asked for, or not supported), setting pty_input
+  // gives the command a pipe for stdin instead of none, fed in line mode:
+  // this process's terminal edits and echoes a line, and pty_input gets it
+  // whole once Enter is pressed. The pipe is closed at the end of input.
+  struct Options {
+    CapturePolicy capture; // how much of each stream the Result keeps
+    int wall_limit_ms = 0;
+    int cpu_limit_ms = 0; // user CPU time of the tree on Windows
+    uint64_t memory_limit_bytes = 0;
+    bool pty = false; // only where pty_supported()
+    std::function<std::string(const std::string &)> pty_input;
+  };
+
+  // Callback type for streaming output: data, length, is_stderr. Called on
+  // the thread that called run(), as soon as the child writes.
   using StreamCallback = std::function<void(const char *, size_t, bool)>;
 
   // Run a command and return the result
-  // command: The command line string (e.g., "cmd /c dir")
+  // command: The command line string (e.g., "cmd /c dir", or "ls -l" which
+  // POSIX hands to /bin/sh -c)
   // callback: Optional function to receive output chunks in real-time
+  //           (always the complete streams)
   static Result run(const std::string &command,
                     StreamCallback callback = nullptr);
+  static Result run(const std::string &command, StreamCallback callback,
+                    const Options &options);
+
+  // Like run, but starts program (a full path) itself instead of a shell
+  // that runs the command line, for commands simple enough not to need
+  // one. args[0] is the name the program is started as; on Windows the
+  // arguments are quoted into a command line the usual way.
+  static Result run_program(const std::string &program,
+                            const std::vector<std::string> &args,
+                            StreamCallback callback, const Options &options);
+
+  // Whether Options::pty works here: Windows 10 1809 or later, or a POSIX
+  // system whose posix_spawn can start a new session
+  static bool pty_supported();
 };
 
+inline ProcessRunner::Result ProcessRunner::run(const std::string &command,
+                                                StreamCallback callback) {
+  return run(command, std::move(callback), Options());
+}
+
 #endif // PROCESS_RUNNER_H
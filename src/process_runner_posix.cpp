@@ -0,0 +1,862 @@
+#include "process_runner.h"
+#include "shell_host.h"
+
+#ifndef _WIN32
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+extern char **environ;
+
+namespace {
+
+// Read size per system call: large enough that a chatty command is read in
+// few calls
+const size_t PIPE_BUFSIZE = 65536;
+// After the process exited, how long to wait for the rest of its output.
+// Normally the pipes report EOF at once; this only runs out when a
+// background grandchild inherited them and keeps them open.
+const int DRAIN_GRACE_MS = 50;
+// How often to check for the exit when the kernel has no pidfd support
+const int EXIT_POLL_MS = 50;
+// How often a cgroup's CPU usage is compared against the CPU limit
+const int CPU_POLL_MS = 100;
+
+// Closes the descriptor when it goes out of scope
+struct Fd {
+  int fd = -1;
+  ~Fd() { reset(); }
+  void reset() {
+    if (fd >= 0)
+      close(fd);
+    fd = -1;
+  }
+};
+
+// Both ends close-on-exec, so only the descriptors dup2'ed onto 1 and 2
+// reach the child
+bool make_pipe(Fd &read_end, Fd &write_end) {
+  int fds[2];
+#ifdef __linux__
+  if (pipe2(fds, O_CLOEXEC) != 0)
+    return false;
+#else
+  if (pipe(fds) != 0)
+    return false;
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+  read_end.fd = fds[0];
+  write_end.fd = fds[1];
+  return true;
+}
+
+// make_pipe for a child's stdin: a socket pair instead, so that writing to
+// a child that no longer reads fails (see send_all) instead of raising
+// SIGPIPE
+bool make_input_channel(Fd &child_end, Fd &our_end) {
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+    return false;
+  child_end.fd = sockets[0];
+  our_end.fd = sockets[1];
+  fcntl(child_end.fd, F_SETFD, FD_CLOEXEC);
+  fcntl(our_end.fd, F_SETFD, FD_CLOEXEC);
+  shutdown(child_end.fd, SHUT_WR);
+  shutdown(our_end.fd, SHUT_RD);
+  return true;
+}
+
+// Writes everything to a socket; false once the other end is gone
+bool send_all(int fd, const char *data, size_t len) {
+  size_t sent = 0;
+  while (sent < len) {
+    ssize_t n = ::send(fd, data + sent, len - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    sent += (size_t)n;
+  }
+  return true;
+}
+
+// A descriptor that polls readable once the process exited (Linux 5.3+),
+// or -1 when unsupported
+int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  return -1;
+#endif
+}
+
+// The child starts with default SIGPIPE/SIGINT handling and no blocked
+// signals, whatever this process set up for itself. Returns the flags that
+// enables; the caller adds its own and sets them.
+short init_spawn_attr(posix_spawnattr_t &attr) {
+  posix_spawnattr_init(&attr);
+  sigset_t signals;
+  sigemptyset(&signals);
+  posix_spawnattr_setsigmask(&attr, &signals);
+  sigaddset(&signals, SIGPIPE);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGQUIT);
+  posix_spawnattr_setsigdefault(&attr, &signals);
+  return POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+}
+
+int exit_code_from_status(int status) {
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status); // what a shell reports
+  return -1;
+}
+
+// Read end of a stdout/stderr pipe
+struct PipeReader {
+  Fd fd;
+  bool is_stderr = false;
+  OutputCapture *output = nullptr;
+
+  bool open() const { return fd.fd >= 0; }
+
+  // Reads everything available without blocking; closes on EOF or error
+  void drain(std::vector<char> &buffer,
+             const ProcessRunner::StreamCallback &callback) {
+    while (true) {
+      ssize_t n = read(fd.fd, buffer.data(), buffer.size());
+      if (n > 0) {
+        if (output)
+          output->append(buffer.data(), (size_t)n);
+        if (callback)
+          callback(buffer.data(), (size_t)n, is_stderr);
+        continue;
+      }
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+      fd.reset();
+      return;
+    }
+  }
+};
+
+// While a command runs on a pty with this process's terminal in raw mode:
+// the settings to restore, also by forward_signal
+std::atomic<bool> g_terminal_raw{false};
+termios g_saved_terminal;
+volatile sig_atomic_t g_window_resized = 0;
+
+void note_window_resize(int) { g_window_resized = 1; }
+
+// Gives the pty this process's window size (80x24 without a terminal)
+void copy_window_size(int master) {
+  winsize size = {};
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 &&
+      ioctl(STDIN_FILENO, TIOCGWINSZ, &size) != 0) {
+    size.ws_col = 80;
+    size.ws_row = 24;
+  }
+  ioctl(master, TIOCSWINSZ, &size);
+}
+
+// A pseudo-terminal for one command. This process keeps the slave side open
+// until the command exits: before the child opened it, reading the master
+// would fail, and afterwards closing it lets the reads end.
+struct Pty {
+  Fd slave;
+  std::string slave_name;
+
+  // The master goes to master (close-on-exec, like the pipes)
+  bool open(Fd &master) {
+    master.fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master.fd < 0 || grantpt(master.fd) != 0 ||
+        unlockpt(master.fd) != 0)
+      return false;
+    fcntl(master.fd, F_SETFD, FD_CLOEXEC);
+#ifdef __linux__
+    char name[128];
+    if (ptsname_r(master.fd, name, sizeof(name)) != 0)
+      return false;
+#else
+    const char *name = ptsname(master.fd);
+    if (!name)
+      return false;
+#endif
+    slave_name = name;
+    slave.fd = ::open(name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (slave.fd < 0)
+      return false;
+    // Same erase key, flow control and so on as this process's terminal
+    termios settings;
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &settings) == 0)
+      tcsetattr(slave.fd, TCSANOW, &settings);
+    copy_window_size(master.fd);
+    return true;
+  }
+};
+
+// This process's terminal while a command runs on a pty: keys reach the
+// command as typed, with no line editing, echo or Ctrl+C handling here
+// (its pty does all that), and window size changes are noted
+struct RawTerminal {
+  bool raw = false;
+  struct sigaction previous_winch;
+
+  RawTerminal() {
+    struct sigaction action = {};
+    action.sa_handler = note_window_resize; // no SA_RESTART: poll wakes up
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGWINCH, &action, &previous_winch);
+    if (isatty(STDIN_FILENO) &&
+        tcgetattr(STDIN_FILENO, &g_saved_terminal) == 0) {
+      termios keys = g_saved_terminal;
+      keys.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+      keys.c_iflag &= ~(ICRNL | INLCR | IGNCR | IXON);
+      keys.c_cc[VMIN] = 1;
+      keys.c_cc[VTIME] = 0;
+      raw = tcsetattr(STDIN_FILENO, TCSANOW, &keys) == 0;
+      g_terminal_raw = raw;
+    }
+  }
+  ~RawTerminal() {
+    if (raw) {
+      g_terminal_raw = false;
+      tcsetattr(STDIN_FILENO, TCSANOW, &g_saved_terminal);
+    }
+    sigaction(SIGWINCH, &previous_winch, nullptr);
+  }
+};
+
+// Commands running right now: -pgid for one in its own process group, else
+// its pid. Signals that end this process are passed on to them first, so
+// that killing ai does not leave them running.
+const int MAX_RUNNING = 64;
+std::atomic<pid_t> g_running[MAX_RUNNING];
+const int FORWARDED_SIGNALS[] = {SIGINT, SIGTERM, SIGHUP};
+struct sigaction g_previous_actions[3];
+std::mutex g_forward_mutex;
+int g_forward_users = 0;
+
+void forward_signal(int sig) {
+  for (std::atomic<pid_t> &running : g_running) {
+    pid_t target = running.load();
+    // Ctrl+C already reached a command in this process's group
+    if (target < 0 || (target > 0 && sig != SIGINT))
+      kill(target, sig);
+  }
+  if (g_terminal_raw)
+    tcsetattr(STDIN_FILENO, TCSANOW, &g_saved_terminal);
+  // Then do whatever this process would have done
+  for (int i = 0; i < 3; ++i) {
+    if (FORWARDED_SIGNALS[i] == sig)
+      sigaction(sig, &g_previous_actions[i], nullptr);
+  }
+  raise(sig);
+}
+
+// Registers a running command for signal forwarding while alive
+struct ForwardSignals {
+  int slot = -1;
+
+  explicit ForwardSignals(pid_t target) {
+    std::lock_guard<std::mutex> lock(g_forward_mutex);
+    for (int i = 0; i < MAX_RUNNING && slot < 0; ++i) {
+      pid_t expected = 0;
+      if (g_running[i].compare_exchange_strong(expected, target))
+        slot = i;
+    }
+    if (g_forward_users++ == 0) {
+      struct sigaction action = {};
+      action.sa_handler = forward_signal;
+      sigemptyset(&action.sa_mask);
+      for (int i = 0; i < 3; ++i)
+        sigaction(FORWARDED_SIGNALS[i], &action, &g_previous_actions[i]);
+    }
+  }
+  ~ForwardSignals() {
+    std::lock_guard<std::mutex> lock(g_forward_mutex);
+    if (slot >= 0)
+      g_running[slot] = 0;
+    if (--g_forward_users == 0) {
+      for (int i = 0; i < 3; ++i)
+        sigaction(FORWARDED_SIGNALS[i], &g_previous_actions[i], nullptr);
+    }
+  }
+};
+
+// A cgroup v2 for one command, created below this process's own cgroup when
+// a CPU or memory limit is set and that cgroup is writable (delegated).
+// Unlike a process group it also holds what the command moved to a new
+// session, and cgroup.kill stops all of it at once.
+struct Cgroup {
+  std::string path; // empty when unavailable
+
+  ~Cgroup() {
+    // Fails while background programs started by the command still run;
+    // the directory is then left behind
+    if (!path.empty())
+      rmdir(path.c_str());
+  }
+
+  bool create(const ProcessRunner::Options &options) {
+    std::ifstream self("/proc/self/cgroup");
+    std::string line, parent;
+    while (std::getline(self, line)) {
+      if (line.compare(0, 3, "0::") == 0)
+        parent = "/sys/fs/cgroup" + line.substr(3);
+    }
+    if (parent.empty() || access((parent + "/cgroup.controllers").c_str(),
+                                 F_OK) != 0)
+      return false; // no unified hierarchy
+    if (parent.back() == '/')
+      parent.pop_back();
+
+    static std::atomic<unsigned> counter{0};
+    path = parent + "/ai-shell-" + std::to_string(getpid()) + "-" +
+           std::to_string(counter++);
+    if (mkdir(path.c_str(), 0755) != 0) {
+      path.clear();
+      return false;
+    }
+    if (options.memory_limit_bytes > 0) {
+      // The memory controller must be enabled for the parent's children
+      if (!write("memory.max", std::to_string(options.memory_limit_bytes))) {
+        rmdir(path.c_str());
+        path.clear();
+        return false;
+      }
+      write("memory.swap.max", "0");
+      write("memory.oom.group", "1"); // the OOM killer takes the whole tree
+    }
+    return true;
+  }
+
+  bool write(const char *file, const std::string &value) {
+    std::ofstream f(path + "/" + file);
+    f << value;
+    f.flush();
+    return f.good();
+  }
+
+  // Value of "key <n>" in a flat-keyed file such as cpu.stat
+  uint64_t read_key(const char *file, const std::string &key) {
+    std::ifstream f(path + "/" + file);
+    std::string name;
+    uint64_t value;
+    while (f >> name >> value) {
+      if (name == key)
+        return value;
+    }
+    return 0;
+  }
+
+  void kill_all() { write("cgroup.kill", "1"); } // Linux 5.14+
+};
+
+// Shell lines run before the command: joining the cgroup, or per-process
+// rlimits where no cgroup is available
+std::string limit_prologue(const ProcessRunner::Options &options,
+                           const Cgroup &cgroup) {
+  if (!cgroup.path.empty())
+    return "echo $$ > '" + cgroup.path + "/cgroup.procs' || exit 125\n";
+  std::string prologue;
+  if (options.cpu_limit_ms > 0) {
+    // SIGXCPU at the soft limit; the hard one (SIGKILL) for processes that
+    // ignore it
+    int seconds = (options.cpu_limit_ms + 999) / 1000;
+    prologue += "ulimit -S -t " + std::to_string(seconds) +
+                "; ulimit -H -t " + std::to_string(seconds + 1) + "\n";
+  }
+  if (options.memory_limit_bytes > 0)
+    prologue += "ulimit -v " +
+                std::to_string(options.memory_limit_bytes / 1024) + "\n";
+  return prologue;
+}
+
+// Spawns path with argv (argv[0] included) and collects its output: the
+// part of run() and run_program() after the cgroup, if any, was created
+ProcessRunner::Result
+spawn_and_wait(const char *path, const std::vector<std::string> &argv,
+               Cgroup &cgroup, const ProcessRunner::StreamCallback &callback,
+               const ProcessRunner::Options &options) {
+  using Termination = ProcessRunner::Termination;
+  ProcessRunner::Result result;
+  result.exit_code = -1;
+
+  // On a pty, out_reader reads the master and there is no stderr pipe.
+  // Without one, pty_input means the command reads a pipe fed with the
+  // lines typed here.
+  bool use_pty = options.pty && ProcessRunner::pty_supported();
+  bool piped_input = !use_pty && options.pty_input;
+  PipeReader out_reader, err_reader;
+  Fd out_write, err_write, in_read, in_write;
+  Pty pty;
+  if (use_pty) {
+    if (!pty.open(out_reader.fd)) {
+      result.stderr_output = "Failed to open a pseudo-terminal.";
+      return result;
+    }
+  } else if (!make_pipe(out_reader.fd, out_write)) {
+    result.stderr_output = "Failed to create stdout pipe.";
+    return result;
+  } else if (!make_pipe(err_reader.fd, err_write)) {
+    result.stderr_output = "Failed to create stderr pipe.";
+    return result;
+  } else if (piped_input && !make_input_channel(in_read, in_write)) {
+    result.stderr_output = "Failed to create stdin pipe.";
+    return result;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (use_pty) {
+    // Opened by the new session's leader, it becomes its controlling
+    // terminal
+    posix_spawn_file_actions_addopen(&actions, 0, pty.slave_name.c_str(),
+                                     O_RDWR, 0);
+    posix_spawn_file_actions_adddup2(&actions, 0, 1);
+    posix_spawn_file_actions_adddup2(&actions, 0, 2);
+  } else {
+    if (piped_input)
+      posix_spawn_file_actions_adddup2(&actions, in_read.fd, 0);
+    else
+      posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out_write.fd, 1);
+    posix_spawn_file_actions_adddup2(&actions, err_write.fd, 2);
+  }
+#if defined(__GLIBC__) &&                                                     \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+  // Descriptors opened by other code without O_CLOEXEC (close_range)
+  posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+#endif
+
+  // Under a limit the child leads a new process group, which is how the
+  // whole tree is killed; otherwise it stays in ours, so it can still
+  // prompt on the terminal. On a pty it leads a new session (and with it a
+  // process group) whose terminal is the pty.
+  posix_spawnattr_t attr;
+  short flags = init_spawn_attr(attr);
+  bool own_group = use_pty || options.wall_limit_ms > 0 ||
+                   options.cpu_limit_ms > 0 || options.memory_limit_bytes > 0;
+#ifdef POSIX_SPAWN_SETSID
+  if (use_pty)
+    flags |= POSIX_SPAWN_SETSID;
+#endif
+  if (own_group && !use_pty) {
+    posix_spawnattr_setpgroup(&attr, 0);
+    flags |= POSIX_SPAWN_SETPGROUP;
+  }
+  posix_spawnattr_setflags(&attr, flags);
+
+  std::vector<char *> args;
+  for (const std::string &arg : argv)
+    args.push_back(const_cast<char *>(arg.c_str()));
+  args.push_back(nullptr);
+  pid_t pid = -1;
+  int err = posix_spawn(&pid, path, &actions, &attr, args.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (err != 0) {
+    result.stderr_output =
+        "posix_spawn failed (" + std::string(std::strerror(err)) + ")";
+    return result;
+  }
+
+  ForwardSignals forward_signals(own_group ? -pid : pid);
+
+  // Close the child's ends in this process
+  out_write.reset();
+  err_write.reset();
+  in_read.reset();
+
+  auto kill_tree = [&] {
+    if (!cgroup.path.empty())
+      cgroup.kill_all();
+    kill(-pid, SIGKILL);
+  };
+  bool has_deadline = options.wall_limit_ms > 0;
+  auto deadline = start + std::chrono::milliseconds(options.wall_limit_ms);
+  bool watch_cpu = options.cpu_limit_ms > 0 && !cgroup.path.empty();
+
+  OutputCapture out_capture(options.capture, ".stdout");
+  OutputCapture err_capture(options.capture, ".stderr");
+  out_reader.output = &out_capture;
+  err_reader.is_stderr = true;
+  err_reader.output = &err_capture;
+  fcntl(out_reader.fd.fd, F_SETFL, O_NONBLOCK);
+  if (err_reader.open())
+    fcntl(err_reader.fd.fd, F_SETFL, O_NONBLOCK);
+
+  Fd pidfd;
+  pidfd.fd = open_pidfd(pid);
+  bool process_running = true;
+  bool reaped = false;
+  int status = 0;
+  rusage usage = {};
+  std::vector<char> buffer(PIPE_BUFSIZE);
+
+  // Keys typed here, on their way to the pty; or, in line mode, whole lines
+  // on their way to the stdin pipe, which takes them with blocking writes
+  std::unique_ptr<RawTerminal> terminal;
+  if (use_pty)
+    terminal.reset(new RawTerminal());
+  bool reading_input = use_pty || piped_input;
+  std::string pending_input;
+
+  // Sleep until output arrives, the process exits or a limit needs
+  // checking; callbacks run on this thread in the order the data arrived
+  while (process_running || out_reader.open() || err_reader.open()) {
+    if (g_window_resized && use_pty && out_reader.open()) {
+      g_window_resized = 0;
+      copy_window_size(out_reader.fd.fd);
+    }
+    pollfd fds[4];
+    PipeReader *readers[4] = {nullptr, nullptr, nullptr, nullptr};
+    nfds_t count = 0;
+    for (PipeReader *r : {&out_reader, &err_reader}) {
+      if (r->open()) {
+        readers[count] = r;
+        short events = POLLIN;
+        if (use_pty && !pending_input.empty())
+          events |= POLLOUT; // the master takes input too
+        fds[count++] = {r->fd.fd, events, 0};
+      }
+    }
+    nfds_t input_index = 4; // none
+    if (process_running && reading_input) {
+      input_index = count;
+      fds[count++] = {STDIN_FILENO, POLLIN, 0};
+    }
+    if (process_running && pidfd.fd >= 0)
+      fds[count++] = {pidfd.fd, POLLIN, 0};
+
+    int timeout = !process_running ? DRAIN_GRACE_MS
+                  : pidfd.fd >= 0  ? -1
+                                   : EXIT_POLL_MS;
+    if (process_running && watch_cpu)
+      timeout = timeout < 0 ? CPU_POLL_MS : std::min(timeout, CPU_POLL_MS);
+    if (process_running && has_deadline) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      deadline - std::chrono::steady_clock::now())
+                      .count();
+      int left_ms = left > 0 ? (int)std::min<long long>(left, INT_MAX) : 0;
+      timeout = timeout < 0 ? left_ms : std::min(timeout, left_ms);
+    }
+    int ready = poll(fds, count, timeout);
+    if (ready < 0 && errno == EINTR)
+      continue;
+    if (ready < 0 || (ready == 0 && !process_running))
+      break;
+
+    for (nfds_t i = 0; i < count; ++i) {
+      if (!fds[i].revents)
+        continue;
+      if (readers[i]) {
+        readers[i]->drain(buffer, callback);
+      } else if (i == input_index && fds[i].revents & (POLLIN | POLLHUP)) {
+        ssize_t n = read(STDIN_FILENO, buffer.data(), buffer.size());
+        if (n > 0) {
+          std::string typed(buffer.data(), (size_t)n);
+          pending_input += options.pty_input ? options.pty_input(typed) : typed;
+        } else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+          // End of input: pass it on as Ctrl+D, or by closing the pipe
+          reading_input = false;
+          if (use_pty)
+            pending_input += '\x04';
+        }
+      } else if (i != input_index) {
+        process_running = false;
+      }
+    }
+    if (process_running && pidfd.fd < 0 &&
+        wait4(pid, &status, WNOHANG, &usage) == pid) {
+      process_running = false;
+      reaped = true;
+    }
+    if (piped_input && in_write.fd >= 0) {
+      if (!pending_input.empty() &&
+          !send_all(in_write.fd, pending_input.data(), pending_input.size()))
+        in_write.reset(); // the command stopped reading
+      pending_input.clear();
+      if (!reading_input || !process_running)
+        in_write.reset();
+      if (in_write.fd < 0)
+        reading_input = false;
+    } else if (!pending_input.empty() && out_reader.open() && use_pty) {
+      ssize_t n = write(out_reader.fd.fd, pending_input.data(),
+                        pending_input.size());
+      if (n > 0)
+        pending_input.erase(0, (size_t)n);
+      else if (n < 0 && errno != EAGAIN && errno != EINTR)
+        pending_input.clear();
+    }
+    if (!process_running)
+      pty.slave.reset(); // the master reads to the end, then fails
+
+    if (!process_running || result.termination != Termination::exited)
+      continue;
+    if (has_deadline && std::chrono::steady_clock::now() >= deadline) {
+      kill_tree();
+      result.termination = Termination::wall_timeout;
+    } else if (watch_cpu && cgroup.read_key("cpu.stat", "usage_usec") >=
+                                (uint64_t)options.cpu_limit_ms * 1000) {
+      kill_tree();
+      result.termination = Termination::cpu_timeout;
+    }
+  }
+
+  terminal.reset();
+  result.stdout_output = out_capture.text();
+  result.stdout_info = out_capture.finish();
+  result.stderr_output = err_capture.text();
+  result.stderr_info = err_capture.finish();
+
+  while (!reaped) {
+    if (wait4(pid, &status, 0, &usage) == pid)
+      reaped = true;
+    else if (errno != EINTR)
+      break;
+  }
+  if (reaped)
+    result.exit_code = exit_code_from_status(status);
+
+  if (result.termination == Termination::exited && reaped) {
+    if (!cgroup.path.empty() && options.memory_limit_bytes > 0 &&
+        cgroup.read_key("memory.events", "oom_kill") > 0)
+      result.termination = Termination::memory_limit;
+    else if (cgroup.path.empty() && options.cpu_limit_ms > 0 &&
+             WIFSIGNALED(status) &&
+             (WTERMSIG(status) == SIGXCPU ||
+              (WTERMSIG(status) == SIGKILL &&
+               (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000 >=
+                   options.cpu_limit_ms)))
+      result.termination = Termination::cpu_timeout; // the ulimit -t
+  }
+  if (result.termination == Termination::wall_timeout ||
+      result.termination == Termination::cpu_timeout)
+    result.exit_code = ProcessRunner::TIMEOUT_EXIT_CODE;
+
+  result.usage.wall_ms = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  result.usage.user_cpu_ms =
+      usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0;
+  result.usage.sys_cpu_ms =
+      usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0;
+#ifdef __APPLE__
+  result.usage.peak_rss_bytes = (uint64_t)usage.ru_maxrss; // bytes
+#else
+  result.usage.peak_rss_bytes = (uint64_t)usage.ru_maxrss * 1024; // KiB
+#endif
+  if (!cgroup.path.empty()) {
+    // Includes what the shell did not wait for
+    result.usage.user_cpu_ms = cgroup.read_key("cpu.stat", "user_usec") / 1000.0;
+    result.usage.sys_cpu_ms =
+        cgroup.read_key("cpu.stat", "system_usec") / 1000.0;
+  }
+
+  return result;
+}
+
+} // namespace
+
+ProcessRunner::Result ProcessRunner::run(const std::string &command,
+                                         StreamCallback callback,
+                                         const Options &options) {
+  Cgroup cgroup;
+  if (options.cpu_limit_ms > 0 || options.memory_limit_bytes > 0)
+    cgroup.create(options);
+  return spawn_and_wait(
+      "/bin/sh", {"/bin/sh", "-c", limit_prologue(options, cgroup) + command},
+      cgroup, callback, options);
+}
+
+ProcessRunner::Result
+ProcessRunner::run_program(const std::string &program,
+                           const std::vector<std::string> &args,
+                           StreamCallback callback, const Options &options) {
+  Cgroup cgroup;
+  if (options.cpu_limit_ms > 0 || options.memory_limit_bytes > 0)
+    cgroup.create(options);
+  std::string prologue = limit_prologue(options, cgroup);
+  if (prologue.empty())
+    return spawn_and_wait(program.c_str(), args, cgroup, callback, options);
+  // Only a shell can apply the limits first; it then execs the program
+  std::vector<std::string> argv = {"/bin/sh", "-c",
+                                   prologue + "exec \"$0\" \"$@\"", program};
+  argv.insert(argv.end(), args.begin() + std::min<size_t>(1, args.size()),
+              args.end());
+  return spawn_and_wait("/bin/sh", argv, cgroup, callback, options);
+}
+
+bool ProcessRunner::pty_supported() {
+#ifdef POSIX_SPAWN_SETSID
+  return true;
+#else
+  return false;
+#endif
+}
+
+// ShellHost transport: bash reading commands from descriptor 3, a socket so
+// that writing to a host that died fails instead of raising SIGPIPE
+
+struct ShellHost::Impl {
+  pid_t pid = -1;
+  Fd channel;
+  Fd pidfd;
+  PipeReader out_reader, err_reader;
+  bool running = true;
+  int status = 0;
+  std::vector<char> buffer;
+
+  Impl() : buffer(PIPE_BUFSIZE) {}
+
+  // Reaps the host if it exited; true while it runs
+  bool check_running() {
+    if (running && waitpid(pid, &status, WNOHANG) == pid)
+      running = false;
+    return running;
+  }
+};
+
+ShellHost::ShellHost(Kind kind) : kind(kind) {}
+
+// Closing the channel ends the host's read loop once the command it is
+// running (if any) returns
+ShellHost::~ShellHost() {}
+
+void ShellHost::stop() { impl.reset(); }
+
+bool ShellHost::launch() {
+  if (kind != Kind::bash)
+    return false;
+  std::unique_ptr<Impl> host(new Impl());
+  Fd out_write, err_write, child_channel;
+  int sockets[2];
+  if (!make_pipe(host->out_reader.fd, out_write) ||
+      !make_pipe(host->err_reader.fd, err_write) ||
+      socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+    return false;
+  host->channel.fd = sockets[0];
+  child_channel.fd = sockets[1];
+  fcntl(host->channel.fd, F_SETFD, FD_CLOEXEC);
+  fcntl(child_channel.fd, F_SETFD, FD_CLOEXEC);
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, out_write.fd, 1);
+  posix_spawn_file_actions_adddup2(&actions, err_write.fd, 2);
+  posix_spawn_file_actions_adddup2(&actions, child_channel.fd, 3);
+#if defined(__GLIBC__) &&                                                     \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+  posix_spawn_file_actions_addclosefrom_np(&actions, 4);
+#endif
+  posix_spawnattr_t attr;
+  posix_spawnattr_setflags(&attr, init_spawn_attr(attr));
+
+  std::string script = startup_command("3");
+  const char *argv[] = {"bash", "--noprofile", "--norc", "-c",
+                        script.c_str(), nullptr};
+  int err = posix_spawnp(&host->pid, "bash", &actions, &attr,
+                         const_cast<char *const *>(argv), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (err != 0)
+    return false;
+
+  host->pidfd.fd = open_pidfd(host->pid);
+  host->err_reader.is_stderr = true;
+  fcntl(host->out_reader.fd.fd, F_SETFL, O_NONBLOCK);
+  fcntl(host->err_reader.fd.fd, F_SETFL, O_NONBLOCK);
+  impl = std::move(host);
+  return true;
+}
+
+bool ShellHost::send(const std::string &message) {
+  if (!impl || !impl->check_running())
+    return false;
+  return send_all(impl->channel.fd, message.data(), message.size());
+}
+
+bool ShellHost::pump(const ProcessRunner::StreamCallback &on_output) {
+  Impl &host = *impl;
+  while (true) {
+    pollfd fds[3];
+    PipeReader *readers[3] = {nullptr, nullptr, nullptr};
+    nfds_t count = 0;
+    for (PipeReader *r : {&host.out_reader, &host.err_reader}) {
+      if (r->open()) {
+        readers[count] = r;
+        fds[count++] = {r->fd.fd, POLLIN, 0};
+      }
+    }
+    if (host.running && host.pidfd.fd >= 0)
+      fds[count++] = {host.pidfd.fd, POLLIN, 0};
+    if (count == 0)
+      return false;
+
+    int timeout = !host.running       ? DRAIN_GRACE_MS
+                  : host.pidfd.fd >= 0 ? -1
+                                       : EXIT_POLL_MS;
+    int ready = poll(fds, count, timeout);
+    if (ready < 0 && errno == EINTR)
+      continue;
+    if (ready < 0 || (ready == 0 && !host.running))
+      return false;
+
+    bool delivered = false;
+    for (nfds_t i = 0; i < count; ++i) {
+      if (!fds[i].revents)
+        continue;
+      if (readers[i]) {
+        readers[i]->drain(host.buffer, on_output);
+        delivered = true;
+      } else {
+        host.check_running();
+      }
+    }
+    if (host.pidfd.fd < 0)
+      host.check_running();
+    if (delivered)
+      return true;
+  }
+}
+
+int ShellHost::exit_code() {
+  while (impl->running) {
+    if (waitpid(impl->pid, &impl->status, 0) == impl->pid ||
+        errno != EINTR)
+      impl->running = false;
+  }
+  return exit_code_from_status(impl->status);
+}
+
+#endif // !_WIN32
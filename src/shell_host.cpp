@@ -0,0 +1,281 @@
+#include "shell_host.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// Shell-specific and platform-independent part of ShellHost. Starting the
+// host process and moving bytes to and from it lives in process_runner.cpp
+// and process_runner_posix.cpp.
+
+namespace {
+
+std::string base64(const std::string &data) {
+  static const char digits[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  out.reserve((data.size() + 2) / 3 * 4);
+  size_t i = 0;
+  for (; i + 2 < data.size(); i += 3) {
+    unsigned v = (unsigned char)data[i] << 16 |
+                 (unsigned char)data[i + 1] << 8 | (unsigned char)data[i + 2];
+    out += digits[v >> 18];
+    out += digits[(v >> 12) & 63];
+    out += digits[(v >> 6) & 63];
+    out += digits[v & 63];
+  }
+  if (i < data.size()) {
+    unsigned v = (unsigned char)data[i] << 16;
+    if (i + 1 < data.size())
+      v |= (unsigned char)data[i + 1] << 8;
+    out += digits[v >> 18];
+    out += digits[(v >> 12) & 63];
+    out += i + 1 < data.size() ? digits[(v >> 6) & 63] : '=';
+    out += '=';
+  }
+  return out;
+}
+
+std::string current_directory() {
+#ifdef _WIN32
+  char buf[MAX_PATH];
+  DWORD n = GetCurrentDirectoryA(MAX_PATH, buf);
+  return n > 0 && n < MAX_PATH ? std::string(buf, n) : ".";
+#else
+  std::vector<char> buf(4096);
+  return getcwd(buf.data(), buf.size()) ? std::string(buf.data()) : ".";
+#endif
+}
+
+// Splits one host stream into the running command's output and the marker
+// that ends it. Bytes that may be the start of the marker are held back
+// until more data shows whether they are. Whatever the stream carries after
+// the marker line (a background job still writing) is dropped.
+class MarkerScanner {
+public:
+  explicit MarkerScanner(const std::string &marker) : marker(marker) {}
+
+  bool done() const { return state == State::done; }
+  // What followed the marker on its line: the exit code on stdout
+  const std::string &trailer() const { return tail; }
+
+  // Appends the command's part of data to out
+  void feed(const char *data, size_t len, std::string &out) {
+    if (state == State::output) {
+      pending.append(data, len);
+      size_t pos = pending.find(marker);
+      if (pos == std::string::npos) {
+        size_t keep = std::min(pending.size(), marker.size() - 1);
+        while (keep > 0 && pending.compare(pending.size() - keep, keep,
+                                           marker, 0, keep) != 0)
+          --keep;
+        out.append(pending, 0, pending.size() - keep);
+        pending.erase(0, pending.size() - keep);
+        return;
+      }
+      out.append(pending, 0, pos);
+      std::string rest = pending.substr(pos + marker.size());
+      pending.clear();
+      state = State::trailer;
+      data = rest.data();
+      len = rest.size();
+      feed_trailer(data, len);
+      return;
+    }
+    if (state == State::trailer)
+      feed_trailer(data, len);
+  }
+
+  // The host died: what was held back was output after all
+  void flush(std::string &out) {
+    out += pending;
+    pending.clear();
+  }
+
+private:
+  enum class State { output, trailer, done };
+
+  void feed_trailer(const char *data, size_t len) {
+    for (size_t i = 0; i < len && state == State::trailer; ++i) {
+      if (data[i] == '\n')
+        state = State::done;
+      else if (data[i] != '\r')
+        tail += data[i];
+    }
+  }
+
+  const std::string &marker;
+  State state = State::output;
+  std::string pending;
+  std::string tail;
+};
+
+} // namespace
+
+ShellHost &ShellHost::shared(Kind kind) {
+  static ShellHost powershell(Kind::powershell);
+  static ShellHost bash(Kind::bash);
+  return kind == Kind::powershell ? powershell : bash;
+}
+
+bool ShellHost::start() {
+  if (impl)
+    return true;
+  static std::atomic<unsigned> counter{0};
+  std::random_device random;
+  std::ostringstream token;
+  token << "__ai_shell_done_" << std::hex << random() << random() << "_"
+        << counter++ << "__";
+  marker = token.str();
+  return launch();
+}
+
+std::string ShellHost::startup_command(const std::string &channel) const {
+  if (kind == Kind::bash) {
+    // channel is the descriptor commands arrive on: the directory and the
+    // command, each NUL-terminated. The subshell keeps cd, exit and set -e
+    // away from the host.
+    return "while IFS= read -r -d '' -u " + channel +
+           " __ai_dir && IFS= read -r -d '' -u " + channel +
+           " __ai_command; do\n"
+           "  (cd -- \"$__ai_dir\" && eval \"$__ai_command\") " +
+           channel +
+           "<&-\n"
+           "  printf '%s%d\\n' '" +
+           marker +
+           "' $?\n"
+           "  printf '%s\\n' '" +
+           marker +
+           "' >&2\n"
+           "done\n";
+  }
+  // channel is the name of a pipe to read commands from, one per line as
+  // base64 directory and script. As with powershell -Command, a command
+  // fails only if its last statement did ($? false): it then exits with
+  // the native exit code it left, or 1. Errors earlier in the line, and
+  // ones silenced with -ErrorAction SilentlyContinue, do not count.
+  std::string script =
+      "$pipe = New-Object System.IO.Pipes.NamedPipeClientStream('.', '" +
+         channel +
+         "', [System.IO.Pipes.PipeDirection]::In)\n"
+         "try { $pipe.Connect(10000) } catch { exit 1 }\n"
+         "$reader = New-Object System.IO.StreamReader($pipe)\n"
+         "$utf8 = [System.Text.Encoding]::UTF8\n"
+         "while ($null -ne ($line = $reader.ReadLine())) {\n"
+         "  $parts = $line.Split(' ')\n"
+         "  $dir = $utf8.GetString([Convert]::FromBase64String($parts[0]))\n"
+         "  $command = $utf8.GetString("
+         "[Convert]::FromBase64String($parts[1]))\n"
+         "  $Error.Clear()\n"
+         "  $global:LASTEXITCODE = 0\n"
+         "  $ok = $false\n"
+         "  try {\n"
+         "    Set-Location -LiteralPath $dir\n"
+         "    [Environment]::CurrentDirectory = $dir\n"
+         "    & ([ScriptBlock]::Create($command)) | Out-Default\n"
+         "    $ok = $?\n"
+         "  } catch {\n"
+         "    [Console]::Error.WriteLine(($_ | Out-String).TrimEnd())\n"
+         "  }\n"
+         "  $code = if ($ok) { 0 } elseif ($global:LASTEXITCODE) "
+         "{ $global:LASTEXITCODE } else { 1 }\n"
+         "  [Console]::Out.Write('" +
+         marker +
+         "' + $code + \"`n\")\n"
+         "  [Console]::Out.Flush()\n"
+         "  [Console]::Error.Write('" +
+         marker +
+         "' + \"`n\")\n"
+         "  [Console]::Error.Flush()\n"
+         "}\n";
+  // -EncodedCommand takes base64 UTF-16LE; the script is ASCII
+  std::string utf16;
+  for (char c : script) {
+    utf16 += c;
+    utf16 += '\0';
+  }
+  return "powershell -NoProfile -NoLogo -ExecutionPolicy Bypass "
+         "-EncodedCommand " +
+         base64(utf16);
+}
+
+std::string ShellHost::frame(const std::string &cwd,
+                             const std::string &script) const {
+  if (kind == Kind::bash)
+    return cwd + '\0' + script + '\0';
+  return base64(cwd) + " " + base64(script) + "\n";
+}
+
+ProcessRunner::Result ShellHost::run(const std::string &script,
+                                     ProcessRunner::StreamCallback callback,
+                                     const CapturePolicy &capture) {
+  ProcessRunner::Result result;
+  result.exit_code = -1;
+  auto start_time = std::chrono::steady_clock::now();
+
+  // A host that died since the last command (or never came up) is replaced
+  // once; the command has not run in it
+  std::string message = frame(current_directory(), script);
+  if (!start() || !send(message)) {
+    stop();
+    if (!start() || !send(message)) {
+      stop();
+      result.stderr_output = "Failed to start the shell host.";
+      return result;
+    }
+  }
+
+  OutputCapture out_capture(capture, ".stdout");
+  OutputCapture err_capture(capture, ".stderr");
+  MarkerScanner scanners[2] = {MarkerScanner(marker), MarkerScanner(marker)};
+  std::string part;
+  ProcessRunner::StreamCallback deliver = [&](const char *data, size_t len,
+                                              bool is_stderr) {
+    part.clear();
+    if (data)
+      scanners[is_stderr].feed(data, len, part);
+    else
+      scanners[is_stderr].flush(part);
+    if (part.empty())
+      return;
+    (is_stderr ? err_capture : out_capture).append(part.data(), part.size());
+    if (callback)
+      callback(part.data(), part.size(), is_stderr);
+  };
+
+  bool host_exited = false;
+  while (!scanners[0].done() || !scanners[1].done()) {
+    if (!pump(deliver)) {
+      host_exited = true;
+      break;
+    }
+  }
+
+  if (host_exited) {
+    // Crashed, or the command ended the host (exit in PowerShell): report
+    // how it ended, and start a fresh host for the next command
+    deliver(nullptr, 0, false);
+    deliver(nullptr, 0, true);
+    result.exit_code = exit_code();
+    stop();
+  } else {
+    result.exit_code = std::atoi(scanners[0].trailer().c_str());
+  }
+
+  result.stdout_output = out_capture.text();
+  result.stdout_info = out_capture.finish();
+  result.stderr_output = err_capture.text();
+  result.stderr_info = err_capture.finish();
+  result.usage.wall_ms = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start_time)
+                             .count();
+  return result;
+}
@@ -0,0 +1,69 @@
+#ifndef SHELL_HOST_H
+#define SHELL_HOST_H
+
+#include "process_runner.h"
+#include <memory>
+#include <string>
+
+// A shell kept running between commands: PowerShell on Windows, bash
+// elsewhere. Commands are written to it over a pipe, and a marker line the
+// host prints after each one delimits its output and carries its exit code.
+// This saves the shell's start-up on every command, and modules it loaded
+// stay loaded. If the host dies (a crash, or the command ran exit), that
+// command reports the host's exit code and the next one starts a new host.
+//
+// Commands run one at a time, in the host's session: the working directory
+// is reset to this process's before each one, but environment variables a
+// PowerShell command sets stay set. bash runs each command in a subshell.
+class ShellHost {
+public:
+  enum class Kind { powershell, bash };
+
+  explicit ShellHost(Kind kind);
+  ~ShellHost();
+  ShellHost(const ShellHost &) = delete;
+  ShellHost &operator=(const ShellHost &) = delete;
+
+  // The hosts execute_command_safely uses, one per kind
+  static ShellHost &shared(Kind kind);
+
+  // Starts the host without waiting for it to be ready, so its start-up
+  // overlaps whatever the caller does next. false if the host cannot run
+  // here (no such shell, or no host support for this kind on this
+  // platform).
+  bool start();
+
+  // Runs script in the host, starting it first if needed. Same streaming
+  // and capture contract as ProcessRunner::run; usage has the wall time
+  // only. No limits: a command that must be stoppable goes to
+  // ProcessRunner.
+  ProcessRunner::Result run(const std::string &script,
+                            ProcessRunner::StreamCallback callback = nullptr,
+                            const CapturePolicy &capture = CapturePolicy());
+
+private:
+  Kind kind;
+  std::string marker; // unique per host process
+
+  // Host process and pipes (process_runner.cpp / process_runner_posix.cpp)
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+
+  // Shell-specific parts (shell_host.cpp)
+  // What starts a host reading commands from channel: the powershell
+  // command line, or the script for bash -c
+  std::string startup_command(const std::string &channel) const;
+  std::string frame(const std::string &cwd, const std::string &script) const;
+
+  // Transport: starts the host process; writes a framed command (false if
+  // the host is gone); waits for output and hands it over (false once the
+  // host exited and its output is drained); the exit code of a host that
+  // exited; drops the host, which exits once its command channel closes.
+  bool launch();
+  bool send(const std::string &message);
+  bool pump(const ProcessRunner::StreamCallback &on_output);
+  int exit_code();
+  void stop();
+};
+
+#endif // SHELL_HOST_H
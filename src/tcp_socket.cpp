@@ -0,0 +1,267 @@
+#include "tcp_socket.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace net {
+
+namespace {
+
+#ifdef _WIN32
+typedef int socklen_type;
+
+struct WinsockInit {
+  WinsockInit() {
+    WSADATA data;
+    WSAStartup(MAKEWORD(2, 2), &data);
+  }
+  ~WinsockInit() { WSACleanup(); }
+};
+
+void ensure_init() { static WinsockInit init; }
+
+bool would_block() {
+  int err = WSAGetLastError();
+  return err == WSAEWOULDBLOCK || err == WSAEINPROGRESS;
+}
+
+int poll_one(socket_t s, short events, int timeout_ms) {
+  WSAPOLLFD pfd;
+  pfd.fd = (SOCKET)s;
+  pfd.events = events;
+  pfd.revents = 0;
+  int rc = WSAPoll(&pfd, 1, timeout_ms);
+  if (rc > 0 && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) &&
+      !(pfd.revents & events))
+    return -1;
+  return rc;
+}
+
+void set_nonblocking(socket_t s, bool on) {
+  u_long mode = on ? 1 : 0;
+  ioctlsocket((SOCKET)s, FIONBIO, &mode);
+}
+#else
+typedef socklen_t socklen_type;
+
+void ensure_init() {
+  // Writing to a socket the server closed must fail, not kill ai
+  static bool once = [] {
+    signal(SIGPIPE, SIG_IGN);
+    return true;
+  }();
+  (void)once;
+}
+
+bool would_block() {
+  return errno == EWOULDBLOCK || errno == EAGAIN || errno == EINPROGRESS;
+}
+
+int poll_one(socket_t s, short events, int timeout_ms) {
+  struct pollfd pfd;
+  pfd.fd = s;
+  pfd.events = events;
+  pfd.revents = 0;
+  int rc;
+  do {
+    rc = poll(&pfd, 1, timeout_ms);
+  } while (rc < 0 && errno == EINTR);
+  if (rc > 0 && (pfd.revents & (POLLERR | POLLNVAL)) && !(pfd.revents & events))
+    return -1;
+  return rc;
+}
+
+void set_nonblocking(socket_t s, bool on) {
+  int flags = fcntl(s, F_GETFL, 0);
+  fcntl(s, F_SETFL, on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+}
+#endif
+
+int remaining_ms(std::chrono::steady_clock::time_point deadline) {
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  deadline - std::chrono::steady_clock::now())
+                  .count();
+  return left > 0 ? (int)left : 0;
+}
+
+} // namespace
+
+socket_t connect_tcp(const std::string &host, int port, int timeout_ms) {
+  ensure_init();
+  struct addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+  struct addrinfo *results = nullptr;
+  std::string port_str = std::to_string(port);
+  if (getaddrinfo(host.c_str(), port_str.c_str(), &hints, &results) != 0)
+    return INVALID_SOCKET_VALUE;
+
+  // "localhost" usually resolves to ::1 first, but local servers such as
+  // Ollama listen on 127.0.0.1 by default, so that is tried first. Each
+  // address gets the whole timeout: a refused connect is not instant on
+  // Windows, where the SYN is retried for about a second even on loopback.
+  std::vector<struct addrinfo *> addresses;
+  for (struct addrinfo *ai = results; ai; ai = ai->ai_next)
+    addresses.push_back(ai);
+  if (host == "localhost")
+    std::stable_partition(
+        addresses.begin(), addresses.end(),
+        [](const struct addrinfo *ai) { return ai->ai_family == AF_INET; });
+
+  socket_t connected = INVALID_SOCKET_VALUE;
+  for (struct addrinfo *ai : addresses) {
+    socket_t s = (socket_t)socket(ai->ai_family, ai->ai_socktype,
+                                  ai->ai_protocol);
+    if (s == INVALID_SOCKET_VALUE)
+      continue;
+    set_nonblocking(s, true);
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeout_ms);
+
+    int rc = connect(s, ai->ai_addr, (socklen_type)ai->ai_addrlen);
+    bool ok = rc == 0;
+    if (!ok && would_block()) {
+      if (poll_one(s, POLLOUT, remaining_ms(deadline)) > 0) {
+        int err = 0;
+        socklen_type len = sizeof(err);
+        getsockopt(s, SOL_SOCKET, SO_ERROR, (char *)&err, &len);
+        ok = err == 0;
+      }
+    }
+    if (ok) {
+      int one = 1;
+      setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+      connected = s;
+      break;
+    }
+    close_socket(s);
+  }
+  freeaddrinfo(results);
+  return connected;
+}
+
+bool send_all(socket_t s, const char *data, size_t len, int timeout_ms) {
+  size_t sent = 0;
+  while (sent < len) {
+#ifdef _WIN32
+    int chunk = (len - sent) > 0x40000000 ? 0x40000000 : (int)(len - sent);
+    long n = send((SOCKET)s, data + sent, chunk, 0);
+#else
+    long n = send(s, data + sent, len - sent, MSG_NOSIGNAL);
+#endif
+    if (n > 0) {
+      sent += (size_t)n;
+      continue;
+    }
+    if (n < 0 && would_block()) {
+      if (poll_one(s, POLLOUT, timeout_ms) > 0)
+        continue;
+    }
+    return false;
+  }
+  return true;
+}
+
+long recv_some(socket_t s, char *buf, size_t len, int timeout_ms) {
+  while (true) {
+#ifdef _WIN32
+    int chunk = len > 0x40000000 ? 0x40000000 : (int)len;
+    long n = recv((SOCKET)s, buf, chunk, 0);
+#else
+    long n = recv(s, buf, len, 0);
+#endif
+    if (n > 0)
+      return n;
+    if (n == 0)
+      return RECV_CLOSED;
+    if (!would_block())
+      return RECV_ERROR;
+    int rc = poll_one(s, POLLIN, timeout_ms);
+    if (rc == 0)
+      return RECV_TIMEOUT;
+    if (rc < 0)
+      return RECV_ERROR;
+  }
+}
+
+bool is_stale(socket_t s) {
+  // An idle connection must have nothing to read; readable means EOF, a
+  // reset or garbage left over from an earlier response
+  return poll_one(s, POLLIN, 0) != 0;
+}
+
+void close_socket(socket_t s) {
+  if (s == INVALID_SOCKET_VALUE)
+    return;
+#ifdef _WIN32
+  closesocket((SOCKET)s);
+#else
+  close(s);
+#endif
+}
+
+socket_t listen_tcp(const std::string &host, int port, int *bound_port) {
+  ensure_init();
+  struct addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  struct addrinfo *results = nullptr;
+  std::string port_str = std::to_string(port);
+  if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port_str.c_str(),
+                  &hints, &results) != 0)
+    return INVALID_SOCKET_VALUE;
+
+  socket_t s = (socket_t)socket(results->ai_family, results->ai_socktype,
+                                results->ai_protocol);
+  if (s == INVALID_SOCKET_VALUE) {
+    freeaddrinfo(results);
+    return INVALID_SOCKET_VALUE;
+  }
+  int one = 1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one));
+  bool ok = bind(s, results->ai_addr, (socklen_type)results->ai_addrlen) == 0 &&
+            listen(s, 64) == 0;
+  freeaddrinfo(results);
+  if (!ok) {
+    close_socket(s);
+    return INVALID_SOCKET_VALUE;
+  }
+  if (bound_port) {
+    struct sockaddr_in addr;
+    socklen_type len = sizeof(addr);
+    getsockname(s, (struct sockaddr *)&addr, &len);
+    *bound_port = ntohs(addr.sin_port);
+  }
+  return s;
+}
+
+socket_t accept_tcp(socket_t listener) {
+  socket_t c = (socket_t)accept(listener, nullptr, nullptr);
+  if (c == INVALID_SOCKET_VALUE)
+    return INVALID_SOCKET_VALUE;
+  int one = 1;
+  setsockopt(c, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+  return c;
+}
+
+} // namespace net
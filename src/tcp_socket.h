@@ -0,0 +1,53 @@
+#ifndef TCP_SOCKET_H
+#define TCP_SOCKET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Thin portable layer over BSD sockets / Winsock used by the socket HTTP
+// backend. All calls are non-throwing and bounded by a timeout.
+namespace net {
+
+#ifdef _WIN32
+using socket_t = std::uintptr_t; // SOCKET
+#else
+using socket_t = int;
+#endif
+
+const socket_t INVALID_SOCKET_VALUE = (socket_t)-1;
+
+// recv_some results besides a byte count
+const long RECV_CLOSED = 0;
+const long RECV_ERROR = -1;
+const long RECV_TIMEOUT = -2;
+
+// Resolves host and connects with a non-blocking connect bounded by
+// timeout_ms for each address tried (IPv4 first for "localhost"). The
+// returned socket is left in non-blocking mode with
+// TCP_NODELAY set. Returns INVALID_SOCKET_VALUE on failure.
+socket_t connect_tcp(const std::string &host, int port, int timeout_ms);
+
+// Writes everything or fails; each wait for buffer space is bounded by
+// timeout_ms.
+bool send_all(socket_t s, const char *data, size_t len, int timeout_ms);
+
+// Waits up to timeout_ms (-1 = forever) for data and reads what is there.
+// Returns the byte count, RECV_CLOSED, RECV_ERROR or RECV_TIMEOUT.
+long recv_some(socket_t s, char *buf, size_t len, int timeout_ms);
+
+// true if the peer closed the connection or unread data is pending, i.e. an
+// idle keep-alive connection can no longer be used for a new request
+bool is_stale(socket_t s);
+
+void close_socket(socket_t s);
+
+// Listening socket for local servers (mock server, benchmarks). Port 0
+// picks a free port; bound_port receives the actual one.
+socket_t listen_tcp(const std::string &host, int port, int *bound_port);
+// Blocking accept; returns a blocking socket or INVALID_SOCKET_VALUE
+socket_t accept_tcp(socket_t listener);
+
+} // namespace net
+
+#endif // TCP_SOCKET_H
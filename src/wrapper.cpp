@@ -2,21 +2,19 @@
 #include "context_manager.h"
 #include "http_client.h"
 #include "json_utils.h"
-#include <atomic>
+#include "llm_router.h"
+#include "process_runner.h"
 #include <iostream>
-#include <mutex>
 #include <string>
-#include <thread>
-#include <vector>
-#include <windows.h>
 
 // Global context/client reused or re-instantiated?
 // We will call direct helpers for AI.
 
 // Helper to ask AI
 std::string query_ai_for_tool(const std::string &user_request,
-                              const std::string &tool_name) {
-  ContextManager cm("context.json");
+                              const std::string &tool_name,
+                              const std::string &base_dir) {
+  ContextManager cm(base_dir);
   AiContext ctx;
   if (!cm.load_context(ctx))
     return "";
@@ -31,15 +29,17 @@ std::string query_ai_for_tool(const std::string &user_request,
       ". "
       "RULES: Return ONLY the code/query. No markdown. No explanation.";
 
-  json::Builder b;
-  b.add("model", ctx.model_name);
-  b.add("stream", false);
-  b.add_message("system", system_prompt);
+  json::ChatRequestWriter w;
+  w.set_model(ctx.model_name);
+  w.set_stream(false);
+  w.set_keep_alive(ctx.keep_alive);
+  w.set_system_prompt(system_prompt);
+  w.begin();
   // TODO: Add history? Wrapper history is tricky.
-  b.add_message("user", user_request);
+  w.add_message("user", user_request);
 
-  http::Client c("localhost", 11434);
-  http::Response r = c.post("/api/chat", b.build());
+  llm::Router router(base_dir, ctx.model_name);
+  http::Response r = router.chat(w);
   if (r.status_code != 200)
     return "";
 
@@ -53,114 +53,207 @@ std::string query_ai_for_tool(const std::string &user_request,
   return cleanCmd;
 }
 
-// Windows Pipe Handling
-HANDLE g_hChildStd_IN_Rd = NULL;
-HANDLE g_hChildStd_IN_Wr = NULL;
-HANDLE g_hChildStd_OUT_Rd = NULL;
-HANDLE g_hChildStd_OUT_Wr = NULL;
+namespace {
 
-void WriteToPipe(const std::string &data) {
-  DWORD dwWritten;
-  WriteFile(g_hChildStd_IN_Wr, data.c_str(), data.length(), &dwWritten, NULL);
-}
+// Watches the keys on their way to the tool. A line typed as "ai <request>"
+// never reaches it: the request is read here, translated by the model and,
+// once confirmed, typed into the tool in its place. Other keys pass straight
+// through, so the tool's own line editing, history and completion work.
+class RequestInterceptor {
+public:
+  RequestInterceptor(const std::string &tool_name, const std::string &base_dir)
+      : tool_name(tool_name), base_dir(base_dir) {}
+
+  // What to send the tool for the keys just typed
+  std::string operator()(const std::string &typed) {
+    std::string send;
+    for (char c : typed)
+      send += key(c);
+    return send;
+  }
+
+private:
+  enum class State { line_start, prefix, passthrough, request, confirm };
 
-void ReadFromPipe() {
-  DWORD dwRead, dwWritten;
-  CHAR chBuf[4096];
-  HANDLE hParentStdOut = GetStdHandle(STD_OUTPUT_HANDLE);
+  const std::string tool_name;
+  const std::string base_dir;
+  State state = State::line_start;
+  std::string held;    // the part of "ai " typed so far
+  std::string request; // after "ai "
+  std::string generated;
+  bool in_escape = false; // skipping an arrow key or the like
 
-  while (true) {
-    BOOL bSuccess = ReadFile(g_hChildStd_OUT_Rd, chBuf, 4096, &dwRead, NULL);
-    if (!bSuccess || dwRead == 0)
-      break;
+  static bool is_enter(char c) { return c == '\r' || c == '\n'; }
+  static bool is_backspace(char c) { return c == '\b' || c == 0x7f; }
 
-    WriteFile(hParentStdOut, chBuf, dwRead, &dwWritten, NULL);
+  static void echo(const std::string &text) { std::cout << text << std::flush; }
+
+  // Starts over on a fresh line; an Enter for the tool prints its prompt
+  std::string new_line() {
+    state = State::line_start;
+    held.clear();
+    return "\r";
   }
-}
 
-void run_in_wrapper(const std::string &command_line,
-                    const std::string &tool_name) {
-  SECURITY_ATTRIBUTES saAttr;
-  saAttr.nLength = sizeof(SECURITY_ATTRIBUTES);
-  saAttr.bInheritHandle = TRUE;
-  saAttr.lpSecurityDescriptor = NULL;
-
-  // Create a pipe for the child process's STDOUT.
-  if (!CreatePipe(&g_hChildStd_OUT_Rd, &g_hChildStd_OUT_Wr, &saAttr, 0))
-    return;
-  SetHandleInformation(g_hChildStd_OUT_Rd, HANDLE_FLAG_INHERIT, 0);
-
-  // Create a pipe for the child process's STDIN.
-  if (!CreatePipe(&g_hChildStd_IN_Rd, &g_hChildStd_IN_Wr, &saAttr, 0))
-    return;
-  SetHandleInformation(g_hChildStd_IN_Wr, HANDLE_FLAG_INHERIT, 0);
-
-  PROCESS_INFORMATION piProcInfo;
-  STARTUPINFOA siStartInfo;
-  ZeroMemory(&piProcInfo, sizeof(PROCESS_INFORMATION));
-  ZeroMemory(&siStartInfo, sizeof(STARTUPINFO));
-  siStartInfo.cb = sizeof(STARTUPINFO);
-  siStartInfo.hStdError = g_hChildStd_OUT_Wr;
-  siStartInfo.hStdOutput = g_hChildStd_OUT_Wr;
-  siStartInfo.hStdInput = g_hChildStd_IN_Rd;
-  siStartInfo.dwFlags |= STARTF_USESTDHANDLES;
-
-  // Create child process
-  std::string cmd = command_line;
-  BOOL bSuccess =
-      CreateProcessA(NULL, const_cast<char *>(cmd.c_str()), NULL, NULL, TRUE, 0,
-                     NULL, NULL, &siStartInfo, &piProcInfo);
-
-  if (!bSuccess)
-    return;
-
-  // Output thread
-  std::thread outputThread(ReadFromPipe);
-  outputThread.detach();
-
-  // Input Loop (Interceptor)
-  // We use std::getline which blocks. This means we might lose single-keystroke
-  // interactivity (tabs/arrows) UNLESS we use low-level console read. For this
-  // prototype, we accept "Line Mode" wrapping which is common for "Wrapper
-  // Mode". Sqlite3 works fine with lines.
+  std::string key(char c) {
+    switch (state) {
+    case State::line_start:
+    case State::prefix:
+      if (c == "ai "[held.size()]) {
+        held += c;
+        echo(std::string(1, c));
+        state = held.size() == 3 ? State::request : State::prefix;
+        request.clear();
+        return "";
+      }
+      if (is_backspace(c) && !held.empty()) {
+        held.pop_back();
+        echo("\b \b");
+        state = held.empty() ? State::line_start : State::prefix;
+        return "";
+      }
+      {
+        // Not a request after all: take back the echo, the tool echoes
+        // the keys itself
+        std::string keys = held + c;
+        for (size_t i = 0; i < held.size(); ++i)
+          echo("\b \b");
+        held.clear();
+        state = is_enter(c) ? State::line_start : State::passthrough;
+        return keys;
+      }
 
-  std::cout
-      << "[AI Wrapper Active. Type 'ai <request>' to generate commands.]\n";
+    case State::passthrough:
+      if (is_enter(c))
+        state = State::line_start;
+      return std::string(1, c);
+
+    case State::request:
+      if (in_escape) {
+        in_escape = !(c >= 0x40 && c <= 0x7e && c != '[');
+        return "";
+      }
+      if (c == 0x1b) {
+        in_escape = true;
+      } else if (c == 0x03) { // Ctrl+C
+        echo("^C\r\n");
+        return new_line();
+      } else if (is_backspace(c)) {
+        if (request.empty()) {
+          held = "ai";
+          state = State::prefix;
+        } else {
+          request.pop_back();
+        }
+        echo("\b \b");
+      } else if (is_enter(c)) {
+        echo("\r\n[Thinking...]");
+        generated = query_ai_for_tool(request, tool_name, base_dir);
+        if (generated.empty()) {
+          echo("\r[No command generated]\r\n");
+          return new_line();
+        }
+        echo("\r> " + generated + "\r\nExecute? [Y/n] ");
+        state = State::confirm;
+      } else if ((unsigned char)c >= 0x20) {
+        request += c;
+        echo(std::string(1, c));
+      }
+      return "";
 
-  std::string line;
-  while (std::getline(std::cin, line)) {
-    // Intercept
-    if (line.rfind("ai ", 0) == 0) {
-      std::cout << "[Thinking...]\r";
-      std::string req = line.substr(3);
-      std::string generated = query_ai_for_tool(req, tool_name);
-
-      // Show generated
-      // Move cursor up?
-      std::cout << "\r> " << generated << "     \n";
-      std::cout << "Execute? [Y/n] ";
-      std::string ans;
-      std::getline(std::cin, ans); // Pause
-
-      if (ans.empty() || ans == "y" || ans == "Y") {
-        generated += "\n"; // Enter
-        WriteToPipe(generated);
+    case State::confirm:
+      if (c == 'y' || c == 'Y' || is_enter(c)) {
+        echo("\r\n");
+        std::string keys = generated;
+        for (char &k : keys) {
+          if (k == '\n')
+            k = '\r';
+        }
+        return keys + new_line();
       }
-    } else {
-      line += "\n";
-      WriteToPipe(line);
+      echo(c == 0x03 ? "^C\r\n" : "\r\n");
+      return new_line();
     }
+    return "";
+  }
+};
+
+// RequestInterceptor for line mode, where there is no pseudo-terminal: the
+// tool reads a pipe, and each line arrives whole, already edited and
+// echoed by the terminal. An "ai <request>" line is answered here, and the
+// line after it is the answer to "Execute? [Y/n]".
+class LineInterceptor {
+public:
+  LineInterceptor(const std::string &tool_name, const std::string &base_dir)
+      : tool_name(tool_name), base_dir(base_dir) {}
+
+  // What to send the tool for the input just read
+  std::string operator()(const std::string &typed) {
+    std::string send;
+    pending += typed;
+    size_t start = 0, eol;
+    while ((eol = pending.find('\n', start)) != std::string::npos) {
+      std::string line = pending.substr(start, eol - start);
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      send += this->line(line);
+      start = eol + 1;
+    }
+    pending.erase(0, start);
+    return send;
+  }
+
+private:
+  const std::string tool_name;
+  const std::string base_dir;
+  std::string pending; // a line not finished yet
+  std::string generated;
+  bool confirming = false;
 
-    // Check if child dead?
-    if (WaitForSingleObject(piProcInfo.hProcess, 0) == WAIT_OBJECT_0)
-      break;
+  std::string line(const std::string &text) {
+    if (confirming) {
+      confirming = false;
+      if (text.empty() || text == "y" || text == "Y")
+        return generated + "\n";
+      return "";
+    }
+    if (text.rfind("ai ", 0) != 0)
+      return text + "\n";
+    std::cout << "[Thinking...]\r" << std::flush;
+    generated = query_ai_for_tool(text.substr(3), tool_name, base_dir);
+    if (generated.empty()) {
+      std::cout << "[No command generated]\n" << std::flush;
+      return "";
+    }
+    std::cout << "\r> " << generated << "     \nExecute? [Y/n] "
+              << std::flush;
+    confirming = true;
+    return "";
   }
+};
+
+} // namespace
 
-  CloseHandle(g_hChildStd_OUT_Wr);
-  CloseHandle(g_hChildStd_IN_Rd);
-  CloseHandle(g_hChildStd_IN_Wr); // Close write end to signal EOF to child
+void run_in_wrapper(const std::string &command_line,
+                    const std::string &tool_name, const std::string &base_dir) {
+  // Line mode on Windows before 10 1809: the tool's prompts and output may
+  // then be buffered, as with any pipe
+  bool use_pty = ProcessRunner::pty_supported();
+  std::cout
+      << "[AI Wrapper Active. Type 'ai <request>' to generate commands.]\n";
 
-  WaitForSingleObject(piProcInfo.hProcess, INFINITE);
-  CloseHandle(piProcInfo.hProcess);
-  CloseHandle(piProcInfo.hThread);
+  RequestInterceptor interceptor(tool_name, base_dir);
+  LineInterceptor lines(tool_name, base_dir);
+  ProcessRunner::Options options;
+  options.pty = use_pty;
+  options.pty_input = [&](const std::string &typed) {
+    return use_pty ? interceptor(typed) : lines(typed);
+  };
+  ProcessRunner::run(
+      command_line,
+      [](const char *data, size_t len, bool) {
+        std::cout.write(data, len);
+        std::cout.flush();
+      },
+      options);
 }
@@ -3,14 +3,13 @@
 
 #include <string>
 
-// Simpler interaction:
-// We just run the logical loop.
-// Since implementing a transparent terminal proxy on Windows is complex
-// (handling VT sequences, formatting, ConPTY), we will abstract it here. For
-// now, we will implement a "Basic Input Interceptor". It might lose some
-// colors/arrow keys if we aren't careful, but it's step 1.
-
+// Runs an interactive tool (python, sqlite3, ssh) on a pseudo-terminal,
+// with what is typed passed through key by key. A line typed as
+// "ai <request>" goes to the model instead, and the query it generates is
+// typed into the tool once confirmed. Without pseudo-terminal support the
+// tool reads a pipe instead, fed line by line.
+// base_dir: directory holding settings.json / sessions (next to ai.exe)
 void run_in_wrapper(const std::string &command_line,
-                    const std::string &tool_name);
+                    const std::string &tool_name, const std::string &base_dir);
 
 #endif